@@ -26,8 +26,15 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ============================================================================*/
 
 #include <locale.h>
+#include <unistd.h>
 #include <glib/gi18n.h>
+#include <glib-unix.h>
 #include "batt_sys.h"
+#include "batt_backend.h"
+#include "batt_stats.h"
+#include "batt_metrics.h"
+#include "batt_draw.h"
+#include "batt_trace.h"
 
 #ifdef LXPLUG
 #include "plugin.h"
@@ -41,31 +48,96 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 /* Typedefs and macros                                                        */
 /*----------------------------------------------------------------------------*/
 
-#define SIM_INTERVAL 500
 #define INTERVAL 5000
+#define HIDDEN_INTERVAL 60000
 
-/* Battery states */
+/* Peripheral batteries are refreshed every DEVICE_TICKS samples - the list of
+ * them is rebuilt when the kernel reports one coming or going */
+#define DEVICE_TICKS 12
+
+/* Charging animation - a sweep from the current level to full, in
+ * ANIM_FRAMES steps of ANIM_STEP us */
+#define ANIM_FRAMES 16
+#define ANIM_STEP 80000
+
+/* Name of the battery given to trace probes - only evaluated when one is
+ * attached, which may be while no backend is open, and not every backend
+ * has a name for its battery */
+#define TRACE_NAME(pt) ((pt)->src.ops && batt_source_ident (&(pt)->src) ? batt_source_ident (&(pt)->src) : "")
+
+/* Tooltip strings */
 typedef enum
 {
-    STAT_UNKNOWN = -1,
-    STAT_DISCHARGING = 0,
-    STAT_CHARGING = 1,
-    STAT_EXT_POWER = 2
-} status_t;
+    TT_CHARGING,
+    TT_CHARGING_MINS,
+    TT_CHARGING_HOURS,
+    TT_CHARGED,
+    TT_DISCHARGING,
+    TT_DISCHARGING_MINS,
+    TT_DISCHARGING_HOURS,
+    TT_POWER,
+    TT_VOLTAGE,
+    TT_HEALTH,
+    TT_ENERGY,
+    TT_DEVICE,
+    TT_ABSENT,
+    NUM_TT
+} tooltip_t;
 
 /*----------------------------------------------------------------------------*/
 /* Global data                                                                */
 /*----------------------------------------------------------------------------*/
 
+static const char *tooltip_src[NUM_TT] = {
+    N_("Charging : %d%%"),
+    N_("Charging : %d%%\nTime remaining : %d minutes"),
+    N_("Charging : %d%%\nTime remaining : %0.1f hours"),
+    N_("Charged : %d%%\nOn external power"),
+    N_("Discharging : %d%%"),
+    N_("Discharging : %d%%\nTime remaining : %d minutes"),
+    N_("Discharging : %d%%\nTime remaining : %0.1f hours"),
+    N_("\nPower : %0.1f W"),
+    N_("\nVoltage : %0.2f V"),
+    N_("\nHealth : %d%% (%d cycles)"),
+    N_("\nToday : %0.2f Wh used, %0.2f Wh charged"),
+    N_("\n%s : %d%%"),
+    N_("Battery removed")
+};
+
+/* Translations of the above, looked up once in batt_init */
+static const char *tooltip_fmt[NUM_TT];
+
+/* Semaphores for the probes in batt_trace.h */
+BATT_TRACE_PROBES (BATT_TRACE_DEFINE)
+
 /*----------------------------------------------------------------------------*/
 /* Prototypes                                                                 */
 /*----------------------------------------------------------------------------*/
 
 static int init_measurement (PtBattPlugin *pt);
-static int charge_level (PtBattPlugin *pt, status_t *status, int *tim);
-static void draw_icon (PtBattPlugin *pt, int lev, float r, float g, float b, int powered);
+static void close_measurement (PtBattPlugin *pt);
+static gboolean source_changed (PtBattPlugin *pt);
+static void stop_animation (PtBattPlugin *pt);
+static void settle_icon (PtBattPlugin *pt);
+static void scan_devices (PtBattPlugin *pt);
+static void update_devices (PtBattPlugin *pt);
+static gboolean device_event (gint fd, GIOCondition, PtBattPlugin *pt);
+static void wait_for_supply (PtBattPlugin *pt);
+static void stop_waiting (PtBattPlugin *pt);
+static gboolean supply_added (gint fd, GIOCondition, PtBattPlugin *pt);
+static void draw_icon (PtBattPlugin *pt, status_t status, int lev);
 static void update_icon (PtBattPlugin *pt);
+static void render_icon (PtBattPlugin *pt);
+static gboolean query_tooltip (GtkWidget *widget, gint x, gint y, gboolean kbd, GtkTooltip *tooltip, PtBattPlugin *pt);
+static guint sample_interval (PtBattPlugin *pt);
 static gboolean timer_event (PtBattPlugin *pt);
+static void visibility_changed (PtBattPlugin *pt);
+static void map_event (GtkWidget *widget, PtBattPlugin *pt);
+static void session_changed (GDBusProxy *proxy, GVariant *changed, GStrv invalidated, PtBattPlugin *pt);
+static void session_found (GObject *source, GAsyncResult *res, gpointer user_data);
+static void session_proxy_ready (GObject *, GAsyncResult *res, gpointer user_data);
+static void manager_signal (GDBusProxy *, gchar *, gchar *signal, GVariant *params, PtBattPlugin *pt);
+static void manager_proxy_ready (GObject *, GAsyncResult *res, gpointer user_data);
 
 /*----------------------------------------------------------------------------*/
 /* Function definitions                                                       */
@@ -75,195 +147,595 @@ static gboolean timer_event (PtBattPlugin *pt);
 
 static int init_measurement (PtBattPlugin *pt)
 {
-    if (pt->simulate) return 1;
+    const char *id;
 
-    pt->batt = battery_get (pt->batt_num);
-    if (pt->batt) return 1;
+    close_measurement (pt);
 
-    return 0;
+    if (!batt_source_open (&pt->src, pt->backend, pt->batt_num)) return 0;
+
+    id = batt_source_ident (&pt->src);
+    if (id) batt_stats_init (&pt->stats, id);
+    pt->watch = batt_source_subscribe (&pt->src, (GSourceFunc) source_changed, pt);
+    pt->snap.status = STAT_UNKNOWN;
+    scan_devices (pt);
+
+    if (pt->show_devices && (pt->device_fd = battery_monitor_open ()) >= 0)
+        pt->device_watch = g_unix_fd_add (pt->device_fd, G_IO_IN, (GUnixFDSourceFunc) device_event, pt);
+    return 1;
 }
 
-/* Read current capacity, status and time remaining from battery */
+/* Release the current battery, saving its statistics */
 
-static int charge_level (PtBattPlugin *pt, status_t *status, int *tim)
+static void close_measurement (PtBattPlugin *pt)
 {
-    if (pt->simulate)
+    if (!pt->src.ops) return;
+
+    if (pt->watch) g_source_remove (pt->watch);
+    pt->watch = 0;
+    if (pt->device_watch)
     {
-        static int level = 0;
-       *tim = 30;
-        if (level < 100) level +=5;
-        else level = -100;
-        if (level < 0)
+        g_source_remove (pt->device_watch);
+        close (pt->device_fd);
+    }
+    pt->device_watch = 0;
+    batt_stats_free (&pt->stats);
+    batt_source_close (&pt->src);
+    g_list_free_full (pt->devices, (GDestroyNotify) battery_free);
+    pt->devices = NULL;
+    battery_fetch_close ();
+}
+
+/* Handler for the backend reporting a change - take a reading straight away */
+
+static gboolean source_changed (PtBattPlugin *pt)
+{
+    update_icon (pt);
+    return TRUE;
+}
+
+/* Find peripheral batteries, if they are to be shown */
+
+static void scan_devices (PtBattPlugin *pt)
+{
+    g_list_free_full (pt->devices, (GDestroyNotify) battery_free);
+    pt->devices = pt->show_devices ? battery_get_devices () : NULL;
+    pt->device_tick = 0;
+}
+
+/* Refresh the peripheral batteries from what was read ahead with the battery
+ * - if any has gone away without the kernel saying so, the list is rebuilt */
+
+static void update_devices (PtBattPlugin *pt)
+{
+    GList *l;
+
+    for (l = pt->devices; l; l = l->next)
+    {
+        if (!battery_update_uevent ((battery *) l->data))
         {
-            *status = STAT_DISCHARGING;
-            return (level * -1);
+            scan_devices (pt);
+            return;
         }
-        else if (level == 100) *status = STAT_EXT_POWER;
-        else *status = STAT_CHARGING;
-        return level;
     }
-    *status = STAT_UNKNOWN;
-    *tim = 0;
-    battery *b = pt->batt;
-    int mins;
-    if (b)
+}
+
+/* Handler for the kernel's uevent socket - rebuild the list of peripherals
+ * when any power supply is added or removed */
+
+static gboolean device_event (gint fd, GIOCondition, PtBattPlugin *pt)
+{
+    char name[64];
+    gboolean rescan = FALSE;
+    int ev;
+
+    while ((ev = battery_monitor_read (fd, name, sizeof (name))) >= 0)
+        if (ev == BATT_EVENT_ADD || ev == BATT_EVENT_REMOVE) rescan = TRUE;
+
+    if (rescan) scan_devices (pt);
+    return G_SOURCE_CONTINUE;
+}
+
+/* With no battery found, watch for power supplies being added, so one fitted
+ * later is picked up - the backends only follow a battery they have opened */
+
+static void wait_for_supply (PtBattPlugin *pt)
+{
+    if (pt->supply_watch || (pt->supply_fd = battery_monitor_open ()) < 0) return;
+    pt->supply_watch = g_unix_fd_add (pt->supply_fd, G_IO_IN, (GUnixFDSourceFunc) supply_added, pt);
+}
+
+static void stop_waiting (PtBattPlugin *pt)
+{
+    if (!pt->supply_watch) return;
+    g_source_remove (pt->supply_watch);
+    close (pt->supply_fd);
+    pt->supply_watch = 0;
+}
+
+static gboolean supply_added (gint fd, GIOCondition, PtBattPlugin *pt)
+{
+    char name[64];
+    gboolean added = FALSE;
+    int ev;
+
+    while ((ev = battery_monitor_read (fd, name, sizeof (name))) >= 0)
+        if (ev == BATT_EVENT_ADD) added = TRUE;
+
+    // this watch is stopped if a battery is found
+    if (added)
+    {
+        batt_set_num (pt);
+        if (pt->timer) gtk_widget_show (pt->plugin);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+/* Draw the icon at the panel's size, and show it */
+
+static void draw_icon (PtBattPlugin *pt, status_t status, int lev)
+{
+    cairo_surface_t *surface;
+    int w, h;
+
+    BATT_TRACE_START (draw, TRACE_NAME (pt));
+    batt_icon_dims (wrap_icon_size (pt), &w, &h);
+    surface = batt_icon_paint (&pt->icon, w, h, status, lev);
+    BATT_TRACE_END (draw, TRACE_NAME (pt));
+    if (!surface) return;
+
+    // hand the surface to the icon - it is drawn from directly, with no copy.
+    // Setting it again would rebuild the image's definition, so once it
+    // holds this surface, only a redraw is needed. The image keeps its own
+    // reference, so a surface recreated at a new size never has the old address.
+    BATT_TRACE_START (apply, TRACE_NAME (pt));
+    if (surface == pt->shown) gtk_widget_queue_draw (pt->tray_icon);
+    else
+    {
+        gtk_image_set_from_surface (GTK_IMAGE (pt->tray_icon), surface);
+        pt->shown = surface;
+    }
+    BATT_TRACE_END (apply, TRACE_NAME (pt));
+}
+
+/* Draw every frame of the charging animation into one surface, a frame high
+ * each, so that showing a frame is a copy. The frames depend on the level, so
+ * are redrawn when it changes, which is rarely, as well as with the size.
+ * Returns FALSE, with no sprite, if the frames could not be drawn. */
+
+static gboolean draw_sprite (PtBattPlugin *pt, int w, int h, int lev)
+{
+    cairo_surface_t *surface;
+    int frame, stride;
+
+    if (pt->sprite && cairo_image_surface_get_width (pt->sprite) == w
+        && cairo_image_surface_get_height (pt->sprite) == h * ANIM_FRAMES && pt->sprite_level == lev) return TRUE;
+
+    if (pt->sprite) cairo_surface_destroy (pt->sprite);
+    pt->sprite = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, w, h * ANIM_FRAMES);
+    pt->sprite_level = lev;
+
+    stride = cairo_image_surface_get_stride (pt->sprite);
+    for (frame = 0; frame < ANIM_FRAMES; frame++)
     {
-        battery_update (b);
-        if (battery_is_charging (b))
+        // each frame is copied whole, so must match the sprite row for row
+        surface = batt_icon_paint (&pt->icon, w, h, STAT_CHARGING, lev + (100 - lev) * frame / (ANIM_FRAMES - 1));
+        if (!surface || cairo_image_surface_get_width (surface) != w || cairo_image_surface_get_height (surface) != h
+            || cairo_image_surface_get_stride (surface) != stride)
         {
-            if (strcasecmp (b->state, "full") == 0) *status = STAT_EXT_POWER;
-            else *status = STAT_CHARGING;
+            cairo_surface_destroy (pt->sprite);
+            pt->sprite = NULL;
+            return FALSE;
         }
-        else *status = STAT_DISCHARGING;
-        mins = b->seconds;
-        mins /= 60;
-        *tim = mins;
-        return b->percentage;
+        cairo_surface_flush (surface);
+        memcpy (cairo_image_surface_get_data (pt->sprite) + frame * h * stride,
+            cairo_image_surface_get_data (surface), h * stride);
     }
-    else return -1;
-}
-
-
-/* Draw the icon in relevant colour and fill level */
-
-static void draw_icon (PtBattPlugin *pt, int lev, float r, float g, float b, int powered)
-{
-    int h, w, f, ic; 
-
-    // calculate dimensions based on icon size
-    ic = wrap_icon_size (pt);
-    w = ic < 36 ? 36 : ic;
-    h = ((w * 10) / 36) * 2; // force it to be even
-    if (h < 18) h = 18;
-    if (h >= ic) h = ic - 2;
-
-    // create and clear the drawing surface
-    cairo_surface_t *surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, w, h);
-    cairo_t *cr = cairo_create (surface);
-    cairo_set_source_rgba (cr, 0, 0, 0, 0);
-    cairo_rectangle (cr, 0, 0, w, h);
-    cairo_fill (cr);
-
-    // draw base icon on surface
-    cairo_set_source_rgb (cr, r, g, b);
-    cairo_rectangle (cr, 4, 1, w - 10, 1);
-    cairo_rectangle (cr, 3, 2, w - 8, 1);
-    cairo_rectangle (cr, 3, h - 3, w - 8, 1);
-    cairo_rectangle (cr, 4, h - 2, w - 10, 1);
-    cairo_rectangle (cr, 2, 3, 2, h - 6);
-    cairo_rectangle (cr, w - 6, 3, 2, h - 6);
-    cairo_rectangle (cr, w - 4, (h >> 1) - 3, 2, 6);
-    cairo_fill (cr);
-
-    cairo_set_source_rgba (cr, r, g, b, 0.5);
-    cairo_rectangle (cr, 3, 1, 1, 1);
-    cairo_rectangle (cr, 2, 2, 1, 1);
-    cairo_rectangle (cr, 2, h - 3, 1, 1);
-    cairo_rectangle (cr, 3, h - 2, 1, 1);
-    cairo_rectangle (cr, w - 6, 1, 1, 1);
-    cairo_rectangle (cr, w - 5, 2, 1, 1);
-    cairo_rectangle (cr, w - 5, h - 3, 1, 1);
-    cairo_rectangle (cr, w - 6, h - 2, 1, 1);
-    cairo_fill (cr);
-
-    // fill the battery
-    if (lev < 0) f = 0;
-    else if (lev > 97) f = w - 12;
-    else
+    cairo_surface_mark_dirty (pt->sprite);
+    return TRUE;
+}
+
+/* Frame clock callback - copies the frame due into the icon surface, which
+ * the icon draws from directly, so no memory is allocated per frame. The
+ * clock runs at the display rate, so most ticks have nothing to do. */
+
+static gboolean animation_tick (GtkWidget *widget, GdkFrameClock *clock, gpointer user_data)
+{
+    PtBattPlugin *pt = (PtBattPlugin *) user_data;
+    int frame, w, h, stride;
+    gint64 start;
+
+    frame = (gdk_frame_clock_get_frame_time (clock) / ANIM_STEP) % ANIM_FRAMES;
+    if (frame == pt->anim_frame || !pt->sprite || !pt->icon.surface) return G_SOURCE_CONTINUE;
+
+    // the icon may have been redrawn at another size since the frames were
+    w = cairo_image_surface_get_width (pt->icon.surface);
+    h = cairo_image_surface_get_height (pt->icon.surface);
+    stride = cairo_image_surface_get_stride (pt->icon.surface);
+    if (cairo_image_surface_get_width (pt->sprite) != w || cairo_image_surface_get_height (pt->sprite) != h * ANIM_FRAMES
+        || cairo_image_surface_get_stride (pt->sprite) != stride) return G_SOURCE_CONTINUE;
+
+    start = pt->metrics.service ? g_get_monotonic_time () : 0;
+    BATT_TRACE_START (frame, TRACE_NAME (pt));
+
+    cairo_surface_flush (pt->icon.surface);
+    memcpy (cairo_image_surface_get_data (pt->icon.surface),
+        cairo_image_surface_get_data (pt->sprite) + frame * h * stride, h * stride);
+    cairo_surface_mark_dirty (pt->icon.surface);
+    gtk_widget_queue_draw (widget);
+    pt->anim_frame = frame;
+
+    BATT_TRACE_END (frame, TRACE_NAME (pt));
+    if (start)
     {
-        f = (w - 12) * lev;
-        f /= 97;
-        if (f > w - 12) f = w - 12;
+        pt->metrics.frames++;
+        pt->metrics.frame_us += g_get_monotonic_time () - start;
     }
-    cairo_set_source_rgb (cr, r, g, b);
-    cairo_rectangle (cr, 5, 4, f, h - 8);
-    cairo_fill (cr);
+    return G_SOURCE_CONTINUE;
+}
+
+/* Start or stop the charging animation to suit the last reading - only
+ * called once the static icon has been drawn, so it is left showing when the
+ * animation stops */
 
-    // show icons
-    if (powered == 1 && pt->flash)
+static void update_animation (PtBattPlugin *pt)
+{
+    int w, h;
+
+    if (!pt->animate || !pt->timer || pt->hidden || pt->idle || pt->snap.status != STAT_CHARGING)
     {
-        gdk_cairo_set_source_pixbuf (cr, pt->flash, (w >> 1) - 15, (h >> 1) - 16);
-        cairo_paint (cr);
+        stop_animation (pt);
+        return;
     }
-    if (powered == 2 && pt->plug)
+
+    batt_icon_dims (wrap_icon_size (pt), &w, &h);
+    if (!draw_sprite (pt, w, h, pt->snap.percentage))
     {
-        gdk_cairo_set_source_pixbuf (cr, pt->plug, (w >> 1) - 16, (h >> 1) - 16);
-        cairo_paint (cr);
+        settle_icon (pt);
+        return;
     }
 
-    // create a pixbuf from the cairo surface
-    GdkPixbuf *pixbuf = gdk_pixbuf_get_from_surface (surface, 0, 0, w, h);
+    // drawing the frames used the icon surface, so put the current one back
+    pt->anim_frame = -1;
+    if (!pt->anim_tick) pt->anim_tick = gtk_widget_add_tick_callback (pt->tray_icon, animation_tick, pt, NULL);
+}
+
+static void stop_animation (PtBattPlugin *pt)
+{
+    if (!pt->anim_tick) return;
+    gtk_widget_remove_tick_callback (pt->tray_icon, pt->anim_tick);
+    pt->anim_tick = 0;
+}
 
-    // copy the pixbuf to the icon resource
-    g_object_ref_sink (pt->tray_icon);
-    gtk_image_set_from_pixbuf (GTK_IMAGE (pt->tray_icon), pixbuf);
+/* Stop the animation part way through a sweep, and put the still icon back
+ * in its place - drawn even if hidden, so that it is right when shown again */
 
-    g_object_unref (pixbuf);
-    cairo_destroy (cr);
+static void settle_icon (PtBattPlugin *pt)
+{
+    stop_animation (pt);
+    draw_icon (pt, pt->snap.status, pt->snap.percentage);
 }
 
 /* Read the current charge state and update the icon accordingly */
 
 static void update_icon (PtBattPlugin *pt)
 {
-    int capacity, time;
-    status_t status;
-    float ftime;
-    char str[255];
+    gint64 start;
+    gboolean valid;
+    status_t last = pt->snap.status;
+    const char *id;
 
     if (!pt->timer) return;
 
-    // read the charge status
-    capacity = charge_level (pt, &status, &time);
-    if (status == STAT_UNKNOWN) return;
-    ftime = time / 60.0;
+    // the cost of the reading is only measured if metrics are being served
+    start = pt->metrics.service ? g_get_monotonic_time () : 0;
+
+    // read the charge status - kept for the tooltip, which is only built when it is shown
+    valid = batt_source_sample (&pt->src, &pt->snap) && pt->snap.status != STAT_UNKNOWN;
+    if (valid && pt->snap.status != STAT_ABSENT)
+    {
+        // the pack put back may not be the one taken out
+        if (last == STAT_ABSENT && (id = batt_source_ident (&pt->src)))
+        {
+            batt_stats_free (&pt->stats);
+            batt_stats_init (&pt->stats, id);
+        }
+
+        batt_stats_update (&pt->stats, &pt->snap);
+
+        // if the driver has no estimate of time remaining, use the learned profile
+        if (pt->snap.seconds < 0) pt->snap.seconds = batt_stats_estimate (&pt->stats, &pt->snap);
+    }
+
+    if (start)
+    {
+        pt->metrics.samples++;
+        pt->metrics.sample_us += g_get_monotonic_time () - start;
+    }
+    if (!valid) return;
+
+    render_icon (pt);
+}
+
+/* Redraw the icon from the last reading, without going near the battery */
+
+static void render_icon (PtBattPlugin *pt)
+{
+    gint64 start;
+
+    // nothing to draw if nobody can see it, or there has been no reading yet
+    if (pt->hidden || pt->snap.status == STAT_UNKNOWN) return;
+
+    start = pt->metrics.service ? g_get_monotonic_time () : 0;
+
+    // fill the battery symbol, then animate it if charging
+    draw_icon (pt, pt->snap.status, pt->snap.percentage);
+    update_animation (pt);
+
+    if (start)
+    {
+        pt->metrics.renders++;
+        pt->metrics.render_us += g_get_monotonic_time () - start;
+    }
+}
+
+/* Build the tooltip from the last reading when the user hovers over the icon */
+
+static gboolean query_tooltip (GtkWidget *, gint, gint, gboolean, GtkTooltip *tooltip, PtBattPlugin *pt)
+{
+    char str[512];
+    int len, capacity = pt->snap.percentage, time = pt->snap.seconds / 60;
+    float ftime = time / 60.0;
+
+    if (!pt->timer || pt->snap.status == STAT_UNKNOWN) return FALSE;
 
-    // fill the battery symbol and create the tooltip
-    if (status == STAT_CHARGING)
+    if (pt->snap.status == STAT_ABSENT)
+    {
+        gtk_tooltip_set_text (tooltip, tooltip_fmt[TT_ABSENT]);
+        return TRUE;
+    }
+
+    if (pt->snap.status == STAT_CHARGING)
     {
         if (time <= 0)
-            sprintf (str, _("Charging : %d%%"), capacity);
+            len = snprintf (str, sizeof (str), tooltip_fmt[TT_CHARGING], capacity);
         else if (time < 90)
-            sprintf (str, _("Charging : %d%%\nTime remaining : %d minutes"), capacity, time);
+            len = snprintf (str, sizeof (str), tooltip_fmt[TT_CHARGING_MINS], capacity, time);
         else
-            sprintf (str, _("Charging : %d%%\nTime remaining : %0.1f hours"), capacity, ftime);
-        draw_icon (pt, capacity, 0.95, 0.64, 0, 1);
-    }
-    else if (status == STAT_EXT_POWER)
-    {
-        sprintf (str, _("Charged : %d%%\nOn external power"), capacity);
-        draw_icon (pt, capacity, 0, 0.85, 0, 2);
+            len = snprintf (str, sizeof (str), tooltip_fmt[TT_CHARGING_HOURS], capacity, ftime);
     }
+    else if (pt->snap.status == STAT_EXT_POWER)
+        len = snprintf (str, sizeof (str), tooltip_fmt[TT_CHARGED], capacity);
     else
     {
         if (time <= 0)
-            sprintf (str, _("Discharging : %d%%"), capacity);
+            len = snprintf (str, sizeof (str), tooltip_fmt[TT_DISCHARGING], capacity);
         else if (time < 90)
-            sprintf (str, _("Discharging : %d%%\nTime remaining : %d minutes"), capacity, time);
+            len = snprintf (str, sizeof (str), tooltip_fmt[TT_DISCHARGING_MINS], capacity, time);
         else
-            sprintf (str, _("Discharging : %d%%\nTime remaining : %0.1f hours"), capacity, ftime);
-        if (capacity <= 20) draw_icon (pt, capacity, 1, 0, 0, 0);
-        else draw_icon (pt, capacity, 0, 0.85, 0, 0);
+            len = snprintf (str, sizeof (str), tooltip_fmt[TT_DISCHARGING_HOURS], capacity, ftime);
     }
 
-    // set the tooltip
-    gtk_widget_set_tooltip_text (pt->tray_icon, str);
+    // add detail from the driver, where available
+    if (pt->snap.power > 0 && len < (int) sizeof (str))
+        len += snprintf (str + len, sizeof (str) - len, tooltip_fmt[TT_POWER], pt->snap.power / 1e6);
+    if (pt->snap.voltage > 0 && len < (int) sizeof (str))
+        len += snprintf (str + len, sizeof (str) - len, tooltip_fmt[TT_VOLTAGE], pt->snap.voltage / 1e6);
+    if (pt->stats.file && pt->stats.wear >= 0 && len < (int) sizeof (str))
+        len += snprintf (str + len, sizeof (str) - len, tooltip_fmt[TT_HEALTH], 100 - pt->stats.wear, pt->stats.cycles);
+    if (pt->stats.file && (pt->stats.day_drawn > 0 || pt->stats.day_charged > 0) && len < (int) sizeof (str))
+        len += snprintf (str + len, sizeof (str) - len, tooltip_fmt[TT_ENERGY], pt->stats.day_drawn / 1e6, pt->stats.day_charged / 1e6);
+
+    // list any peripheral batteries which report a level
+    for (GList *l = pt->devices; l; l = l->next)
+    {
+        battery *b = (battery *) l->data;
+        if ((b->capacity >= 0 || b->charge_full > 0 || b->energy_full > 0) && len < (int) sizeof (str))
+            len += snprintf (str + len, sizeof (str) - len, tooltip_fmt[TT_DEVICE], b->model ? b->model : b->path, b->percentage);
+    }
+
+    gtk_tooltip_set_text (tooltip, str);
+    return TRUE;
+}
+
+/* Sample slowly while the icon is hidden or the session is idle, unless the battery is low */
+
+static guint sample_interval (PtBattPlugin *pt)
+{
+    if (pt->src.ops && pt->src.ops->interval) return pt->src.ops->interval;
+    if (!pt->hidden && !pt->idle) return INTERVAL;
+    if (pt->snap.status == STAT_DISCHARGING && pt->snap.percentage <= CRITICAL_LEVEL) return INTERVAL;
+    return HIDDEN_INTERVAL;
 }
 
 static gboolean timer_event (PtBattPlugin *pt)
 {
+    gboolean devices = pt->show_devices && ++pt->device_tick >= DEVICE_TICKS;
+
+    BATT_TRACE_START (timer, TRACE_NAME (pt));
+
+    // when the peripherals are due, they are read in one pass with the battery
+    if (devices)
+    {
+        pt->device_tick = 0;
+        batt_source_fetch (&pt->src, pt->devices);
+    }
     update_icon (pt);
-    return TRUE;
+    if (devices) update_devices (pt);
+
+    BATT_TRACE_END (timer, TRACE_NAME (pt));
+    if (sample_interval (pt) == pt->interval) return TRUE;
+
+    /* Cadence has changed - replace this timer */
+    pt->interval = sample_interval (pt);
+    pt->timer = g_timeout_add (pt->interval, (GSourceFunc) timer_event, (gpointer) pt);
+    return FALSE;
+}
+
+/* Refresh straight away on becoming visible, and adjust the sampling rate */
+
+static void visibility_changed (PtBattPlugin *pt)
+{
+    // nothing to animate for, even if the readings carry on
+    if ((pt->hidden || pt->idle) && pt->anim_tick) settle_icon (pt);
+
+    if (!pt->timer) return;
+
+    if (!pt->hidden && !pt->idle) update_icon (pt);
+    if (sample_interval (pt) == pt->interval) return;
+
+    g_source_remove (pt->timer);
+    pt->interval = sample_interval (pt);
+    pt->timer = g_timeout_add (pt->interval, (GSourceFunc) timer_event, (gpointer) pt);
+}
+
+/* Handler for map and unmap signals - includes the panel autohiding */
+
+static void map_event (GtkWidget *widget, PtBattPlugin *pt)
+{
+    pt->hidden = !gtk_widget_get_mapped (widget);
+    visibility_changed (pt);
+}
+
+/* Handler for changes to the logind session idle and lock hints */
+
+static void session_changed (GDBusProxy *proxy, GVariant *, GStrv, PtBattPlugin *pt)
+{
+    GVariant *var;
+    gboolean idle = FALSE;
+
+    var = g_dbus_proxy_get_cached_property (proxy, "IdleHint");
+    if (var)
+    {
+        idle |= g_variant_get_boolean (var);
+        g_variant_unref (var);
+    }
+    var = g_dbus_proxy_get_cached_property (proxy, "LockedHint");
+    if (var)
+    {
+        idle |= g_variant_get_boolean (var);
+        g_variant_unref (var);
+    }
+
+    if (idle == pt->idle) return;
+    pt->idle = idle;
+    visibility_changed (pt);
+}
+
+/* Reply to the manager's GetSession - logind only signals property changes
+ * on a session's own object path, never on the auto alias, so the proxy is
+ * made for the path the manager resolves it to */
+
+static void session_found (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    PtBattPlugin *pt = (PtBattPlugin *) user_data;
+    GError *err = NULL;
+    GVariant *ret = g_dbus_proxy_call_finish (G_DBUS_PROXY (source), res, &err);
+    const gchar *path;
+
+    if (!ret)
+    {
+        /* Don't touch the plugin if it has been destroyed */
+        if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_message ("batt: no logind session - idle state not monitored : %s", err->message);
+        g_error_free (err);
+        return;
+    }
+
+    g_variant_get (ret, "(&o)", &path);
+    g_dbus_proxy_new_for_bus (G_BUS_TYPE_SYSTEM, G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START, NULL,
+        "org.freedesktop.login1", path, "org.freedesktop.login1.Session",
+        pt->cancel, session_proxy_ready, pt);
+    g_variant_unref (ret);
+}
+
+static void session_proxy_ready (GObject *, GAsyncResult *res, gpointer user_data)
+{
+    PtBattPlugin *pt = (PtBattPlugin *) user_data;
+    GError *err = NULL;
+    GDBusProxy *proxy = g_dbus_proxy_new_for_bus_finish (res, &err);
+
+    if (!proxy)
+    {
+        /* Don't touch the plugin if it has been destroyed */
+        if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_message ("batt: no logind session - idle state not monitored : %s", err->message);
+        g_error_free (err);
+        return;
+    }
+
+    pt->session = proxy;
+    g_signal_connect (proxy, "g-properties-changed", G_CALLBACK (session_changed), pt);
+    session_changed (proxy, NULL, NULL, pt);
+}
+
+/* Handler for logind announcing a suspend or resume - sampling stops before
+ * the system sleeps, and a reading is taken as soon as it wakes rather than
+ * leaving the icon stale until the next tick */
+
+static void manager_signal (GDBusProxy *, gchar *, gchar *signal, GVariant *params, PtBattPlugin *pt)
+{
+    gboolean sleeping;
+
+    if (g_strcmp0 (signal, "PrepareForSleep") || !g_variant_is_of_type (params, G_VARIANT_TYPE ("(b)"))) return;
+    g_variant_get (params, "(b)", &sleeping);
+
+    if (sleeping)
+    {
+        if (!pt->timer) return;
+        g_source_remove (pt->timer);
+        pt->timer = 0;
+        pt->asleep = TRUE;
+        if (pt->anim_tick) settle_icon (pt);
+
+        // the system may never wake, if the battery runs flat while asleep
+        batt_stats_save (&pt->stats);
+    }
+    else
+    {
+        if (!pt->asleep) return;
+        pt->asleep = FALSE;
+
+        // step timings cannot span the gap
+        batt_stats_resume (&pt->stats);
+
+        pt->interval = sample_interval (pt);
+        pt->timer = g_timeout_add (pt->interval, (GSourceFunc) timer_event, (gpointer) pt);
+        update_icon (pt);
+    }
+}
+
+static void manager_proxy_ready (GObject *, GAsyncResult *res, gpointer user_data)
+{
+    PtBattPlugin *pt = (PtBattPlugin *) user_data;
+    GError *err = NULL;
+    GDBusProxy *proxy = g_dbus_proxy_new_for_bus_finish (res, &err);
+
+    if (!proxy)
+    {
+        /* Don't touch the plugin if it has been destroyed */
+        if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_message ("batt: no logind - suspend not monitored : %s", err->message);
+        g_error_free (err);
+        return;
+    }
+
+    pt->manager = proxy;
+    g_signal_connect (proxy, "g-signal", G_CALLBACK (manager_signal), pt);
+
+    /* Find the session this panel is running in, to watch its idle state */
+    g_dbus_proxy_call (proxy, "GetSession", g_variant_new ("(s)", "auto"), G_DBUS_CALL_FLAGS_NONE, -1,
+        pt->cancel, session_found, pt);
 }
 
 /*----------------------------------------------------------------------------*/
 /* wf-panel plugin functions                                                  */
 /*----------------------------------------------------------------------------*/
 
-/* Handler for system config changed message from panel */
+/* Handler for system config changed message from panel - only the drawing
+ * can have changed, so the last reading is reused rather than taking another */
 void batt_update_display (PtBattPlugin *pt)
 {
-    if (pt->timer) update_icon (pt);
+    if (pt->timer || pt->asleep) render_icon (pt);
     else gtk_widget_hide (pt->plugin);
 }
 
@@ -271,10 +743,20 @@ void batt_update_display (PtBattPlugin *pt)
 void batt_set_num (PtBattPlugin *pt)
 {
     if (pt->timer) g_source_remove (pt->timer);
+    pt->asleep = FALSE;
+    stop_animation (pt);
     if (init_measurement (pt))
-        pt->timer = g_timeout_add (pt->simulate ? SIM_INTERVAL : INTERVAL, (GSourceFunc) timer_event, (gpointer) pt);
+    {
+        stop_waiting (pt);
+        pt->interval = sample_interval (pt);
+        pt->timer = g_timeout_add (pt->interval, (GSourceFunc) timer_event, (gpointer) pt);
+        update_icon (pt);
+    }
     else
+    {
         pt->timer = 0;
+        wait_for_supply (pt);
+    }
 }
 
 void batt_init (PtBattPlugin *pt)
@@ -283,16 +765,41 @@ void batt_init (PtBattPlugin *pt)
     bindtextdomain (GETTEXT_PACKAGE, PACKAGE_LOCALE_DIR);
     bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
 
+    /* Look up the tooltip translations */
+    for (int i = 0; i < NUM_TT; i++) tooltip_fmt[i] = _(tooltip_src[i]);
+
     /* Allocate icon as a child of top level */
     pt->tray_icon = gtk_image_new ();
     gtk_container_add (GTK_CONTAINER (pt->plugin), pt->tray_icon);
 
+    /* Tooltip is generated on demand */
+    pt->snap.status = STAT_UNKNOWN;
+    gtk_widget_set_has_tooltip (pt->tray_icon, TRUE);
+    g_signal_connect (pt->tray_icon, "query-tooltip", G_CALLBACK (query_tooltip), pt);
+
     /* Load the symbols */
-    pt->plug = gdk_pixbuf_new_from_file (PACKAGE_DATA_DIR "/images/plug.png", NULL);
-    pt->flash = gdk_pixbuf_new_from_file (PACKAGE_DATA_DIR "/images/flash.png", NULL);
+    batt_icon_init (&pt->icon, PACKAGE_DATA_DIR "/images/plug.png", PACKAGE_DATA_DIR "/images/flash.png");
+
+    /* Select the backend - PLUGIN_SIMBAT is kept as a shorthand for the simulator */
+    if (getenv ("PLUGIN_SIMBAT")) pt->backend = "sim";
+    else pt->backend = getenv ("PLUGIN_BATT_BACKEND");
+
+    /* Serve metrics if asked - PLUGIN_BATT_METRICS gives the socket path,
+     * relative to the runtime directory unless absolute */
+    if (getenv ("PLUGIN_BATT_METRICS"))
+        batt_metrics_start (&pt->metrics, getenv ("PLUGIN_BATT_METRICS"), &pt->src, &pt->snap, &pt->stats);
+
+    /* Watch for the icon being hidden */
+    g_signal_connect (pt->plugin, "map", G_CALLBACK (map_event), pt);
+    g_signal_connect (pt->plugin, "unmap", G_CALLBACK (map_event), pt);
 
-    if (getenv ("PLUGIN_SIMBAT")) pt->simulate = TRUE;
-    else pt->simulate = FALSE;
+    /* Watch for suspend and resume, and through the manager for the session
+     * going idle - a private bus can stand in for the system one by setting
+     * DBUS_SYSTEM_BUS_ADDRESS */
+    pt->cancel = g_cancellable_new ();
+    g_dbus_proxy_new_for_bus (G_BUS_TYPE_SYSTEM, G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START | G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
+        NULL, "org.freedesktop.login1", "/org/freedesktop/login1", "org.freedesktop.login1.Manager",
+        pt->cancel, manager_proxy_ready, pt);
 
     /* Start timed events to monitor status */
     batt_set_num (pt);
@@ -305,8 +812,33 @@ void batt_destructor (gpointer user_data)
 {
     PtBattPlugin *pt = (PtBattPlugin *) user_data;
 
-    /* Disconnect the timer */
+    /* Disconnect the timer, the frame clock and any wait for a battery */
     if (pt->timer) g_source_remove (pt->timer);
+    stop_waiting (pt);
+    stop_animation (pt);
+
+    /* Stop watching the icon, the session and the system */
+    g_signal_handlers_disconnect_by_data (pt->plugin, pt);
+    g_cancellable_cancel (pt->cancel);
+    g_object_unref (pt->cancel);
+    if (pt->session)
+    {
+        g_signal_handlers_disconnect_by_data (pt->session, pt);
+        g_object_unref (pt->session);
+    }
+    if (pt->manager)
+    {
+        g_signal_handlers_disconnect_by_data (pt->manager, pt);
+        g_object_unref (pt->manager);
+    }
+
+    /* Stop serving metrics, save statistics and release the battery */
+    batt_metrics_stop (&pt->metrics);
+    close_measurement (pt);
+
+    /* Release the drawing surfaces */
+    if (pt->sprite) cairo_surface_destroy (pt->sprite);
+    batt_icon_free (&pt->icon);
 
     g_free (pt);
 }
@@ -330,6 +862,8 @@ static GtkWidget *ptbatt_constructor (LXPanel *panel, config_setting_t *settings
 
     /* Read config */
     if (!config_setting_lookup_int (pt->settings, "BattNum", &pt->batt_num)) pt->batt_num = 0;
+    if (!config_setting_lookup_int (pt->settings, "ShowDevices", &pt->show_devices)) pt->show_devices = FALSE;
+    if (!config_setting_lookup_int (pt->settings, "Animate", &pt->animate)) pt->animate = FALSE;
 
     batt_init (pt);
     return pt->plugin;
@@ -348,6 +882,8 @@ static gboolean ptbatt_apply_configuration (gpointer user_data)
     PtBattPlugin *pt = lxpanel_plugin_get_data (GTK_WIDGET (user_data));
 
     config_group_set_int (pt->settings, "BattNum", pt->batt_num);
+    config_group_set_int (pt->settings, "ShowDevices", pt->show_devices);
+    config_group_set_int (pt->settings, "Animate", pt->animate);
 
     batt_set_num (pt);
     return FALSE;
@@ -361,6 +897,8 @@ static GtkWidget *ptbatt_configure (LXPanel *panel, GtkWidget *plugin)
     return lxpanel_generic_config_dlg(_("Battery"), panel,
         ptbatt_apply_configuration, plugin,
         _("Battery number to monitor"), &pt->batt_num, CONF_TYPE_INT,
+        _("Show peripheral batteries"), &pt->show_devices, CONF_TYPE_BOOL,
+        _("Animate while charging"), &pt->animate, CONF_TYPE_BOOL,
         NULL);
 }
 
@@ -33,9 +33,11 @@ extern "C" {
     WayfireWidget *create () { return new WayfireBatt; }
     void destroy (WayfireWidget *w) { delete w; }
 
-    static constexpr conf_table_t conf_table[2] = {
-        {CONF_INT,  "batt_num", N_("Battery number to monitor")},
-        {CONF_NONE, NULL,       NULL}
+    static constexpr conf_table_t conf_table[4] = {
+        {CONF_INT,  "batt_num",     N_("Battery number to monitor")},
+        {CONF_BOOL, "show_devices", N_("Show peripheral batteries")},
+        {CONF_BOOL, "animate",      N_("Animate while charging")},
+        {CONF_NONE, NULL,           NULL}
     };
     const conf_table_t *config_params (void) { return conf_table; };
     const char *display_name (void) { return N_("Battery"); };
@@ -63,6 +65,8 @@ bool WayfireBatt::set_icon (void)
 void WayfireBatt::settings_changed_cb (void)
 {
     pt->batt_num = batt_num;
+    pt->show_devices = show_devices;
+    pt->animate = animate;
     batt_set_num (pt);
 }
 
@@ -84,6 +88,8 @@ void WayfireBatt::init (Gtk::HBox *container)
     gesture = add_longpress_default (*plugin);
 
     pt->batt_num = batt_num;
+    pt->show_devices = show_devices;
+    pt->animate = animate;
 
     /* Initialise the plugin */
     batt_init (pt);
@@ -93,6 +99,8 @@ void WayfireBatt::init (Gtk::HBox *container)
     bar_pos.set_callback (sigc::mem_fun (*this, &WayfireBatt::bar_pos_changed_cb));
 
     batt_num.set_callback (sigc::mem_fun (*this, &WayfireBatt::settings_changed_cb));
+    show_devices.set_callback (sigc::mem_fun (*this, &WayfireBatt::settings_changed_cb));
+    animate.set_callback (sigc::mem_fun (*this, &WayfireBatt::settings_changed_cb));
 }
 
 WayfireBatt::~WayfireBatt()
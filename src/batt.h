@@ -42,13 +42,36 @@ typedef struct
 #endif
 
     GtkWidget *tray_icon;           /* Displayed image */
-    battery *batt;
-    GdkPixbuf *plug;
-    GdkPixbuf *flash;
+    BattSource src;                 /* Backend supplying readings */
+    BattSnapshot snap;              /* Last reading */
+    guint watch;                    /* Backend change notification */
+    BattStats stats;                /* Health and wear analytics */
+    BattMetrics metrics;            /* Metrics served on a local socket */
+    BattIcon icon;                  /* Icon drawing */
+    cairo_surface_t *shown;         /* Surface last given to the image, only compared */
+    cairo_surface_t *sprite;        /* Charging animation frames, stacked top to bottom */
+    int sprite_level;               /* Charge level the frames were drawn from */
+    guint anim_tick;                /* Frame clock callback, 0 when not animating */
+    int anim_frame;                 /* Frame last shown */
     guint timer;
     guint vtimer;
+    guint interval;                 /* Current sampling interval */
+    gboolean hidden;                /* Icon is not mapped */
+    gboolean idle;                  /* Session is idle or locked */
+    GDBusProxy *session;            /* logind session, for idle and lock hints */
+    GDBusProxy *manager;            /* logind manager, for suspend and resume */
+    gboolean asleep;                /* System is suspending - sampling stopped */
+    GCancellable *cancel;
     int batt_num;
-    gboolean simulate;
+    gboolean show_devices;          /* List peripheral batteries in the tooltip */
+    gboolean animate;               /* Animate the icon while charging */
+    GList *devices;                 /* Peripheral batteries */
+    int device_tick;
+    int device_fd;                  /* uevent socket, for peripherals coming and going */
+    guint device_watch;
+    int supply_fd;                  /* uevent socket, while waiting for a battery to be fitted */
+    guint supply_watch;
+    const char *backend;            /* Name of backend, or NULL for the default */
 } PtBattPlugin;
 
 /*----------------------------------------------------------------------------*/
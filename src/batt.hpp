@@ -34,7 +34,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 extern "C" {
 #include "lxutils.h"
-#include "batt_sys.h"
+#include "batt_backend.h"
+#include "batt_stats.h"
+#include "batt_metrics.h"
+#include "batt_draw.h"
 #include "batt.h"
 }
 
@@ -48,6 +51,8 @@ class WayfireBatt : public WayfireWidget
     sigc::connection icon_timer;
 
     WfOption <int> batt_num {"panel/batt_batt_num"};
+    WfOption <bool> show_devices {"panel/batt_show_devices"};
+    WfOption <bool> animate {"panel/batt_animate"};
 
     /* plugin */
     PtBattPlugin *pt;
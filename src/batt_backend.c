@@ -0,0 +1,463 @@
+/*============================================================================
+Copyright (c) 2025 Raspberry Pi Holdings Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+============================================================================*/
+
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <glib-unix.h>
+#include "batt_sys.h"
+#include "batt_backend.h"
+
+/*----------------------------------------------------------------------------*/
+/* Typedefs and macros                                                        */
+/*----------------------------------------------------------------------------*/
+
+#ifdef BATT_BACKEND_ONLY
+#define HAVE_BACKEND(b) (BATT_BACKEND_ONLY == (b))
+#else
+#define HAVE_BACKEND(b) 1
+#endif
+
+#if BATT_BACKEND_ONLY == BATT_BACKEND_SYSFS
+#define ONLY(fn) sysfs_##fn
+#elif BATT_BACKEND_ONLY == BATT_BACKEND_UEVENT
+#define ONLY(fn) uevent_##fn
+#elif BATT_BACKEND_ONLY == BATT_BACKEND_SIM
+#define ONLY(fn) sim_##fn
+#elif BATT_BACKEND_ONLY == BATT_BACKEND_REPLAY
+#define ONLY(fn) replay_##fn
+#endif
+
+#define SIM_INTERVAL 500
+
+typedef struct
+{
+    int fd;
+    battery *b;
+    gboolean changes;               /* Notify of changes as well as removal and return */
+    GSourceFunc func;
+    gpointer data;
+} UeventWatch;
+
+typedef struct
+{
+    int level;
+} SimBattery;
+
+typedef struct
+{
+    BattSnapshot *snaps;
+    int count;
+    int pos;
+} Replay;
+
+/*----------------------------------------------------------------------------*/
+/* Function definitions                                                       */
+/*----------------------------------------------------------------------------*/
+
+#if HAVE_BACKEND(BATT_BACKEND_SYSFS) || HAVE_BACKEND(BATT_BACKEND_UEVENT)
+
+/* Fill in a snapshot from a battery read from sysfs */
+
+static void battery_snapshot (battery *b, BattSnapshot *snap)
+{
+    if (battery_is_charging (b))
+    {
+        if (strcasecmp (b->state, "full") == 0) snap->status = STAT_EXT_POWER;
+        else snap->status = STAT_CHARGING;
+    }
+    else snap->status = STAT_DISCHARGING;
+
+    snap->percentage = b->percentage;
+    snap->seconds = b->seconds;
+    snap->voltage = b->voltage_now;
+    if (b->power_now > 0) snap->power = b->power_now;
+    else if (b->current_now > 0 && b->voltage_now > 0 && b->current_now <= G_MAXINT64 / b->voltage_now)
+        snap->power = b->current_now * b->voltage_now / 1000000;
+    else snap->power = -1;
+
+    /* Use whichever of the charge and energy families the driver supplies */
+    if (b->charge_full > 0)
+    {
+        snap->full = b->charge_full;
+        snap->design = b->charge_full_design;
+    }
+    else
+    {
+        snap->full = b->energy_full;
+        snap->design = b->energy_full_design;
+    }
+}
+
+/* Fill in a snapshot for a battery which has been taken out */
+
+static void absent_snapshot (BattSnapshot *snap)
+{
+    snap->status = STAT_ABSENT;
+    snap->percentage = 0;
+    snap->seconds = -1;
+    snap->power = -1;
+    snap->voltage = -1;
+    snap->full = -1;
+    snap->design = -1;
+}
+
+static gpointer sysfs_open (int num)
+{
+    return battery_get (num);
+}
+
+static const char *sysfs_ident (gpointer handle)
+{
+    return ((battery *) handle)->id;
+}
+
+static void sysfs_close (gpointer handle)
+{
+    battery_free ((battery *) handle);
+}
+
+/* Handler for the kernel's uevent socket - the battery is marked as removed
+ * when its supply goes, and rebound when it, or the same pack under another
+ * name, comes back */
+
+static gboolean uevent_event (gint fd, GIOCondition, gpointer user_data)
+{
+    UeventWatch *w = (UeventWatch *) user_data;
+    char name[64];
+    gboolean changed = FALSE;
+    int ev;
+
+    /* Drain everything pending, then notify once */
+    while ((ev = battery_monitor_read (fd, name, sizeof (name))) >= 0)
+    {
+        if (ev == BATT_EVENT_NONE) continue;
+        if (ev == BATT_EVENT_ADD && w->b->removed) changed |= battery_rebind (w->b, name);
+        else if (strcmp (name, w->b->path)) continue;
+        else if (ev == BATT_EVENT_REMOVE) changed = w->b->removed = TRUE;
+        else if (ev == BATT_EVENT_CHANGE && w->changes) changed = TRUE;
+    }
+
+    if (changed) w->func (w->data);
+    return G_SOURCE_CONTINUE;
+}
+
+static void uevent_unwatch (gpointer user_data)
+{
+    UeventWatch *w = (UeventWatch *) user_data;
+
+    close (w->fd);
+    g_free (w);
+}
+
+static guint supply_watch (battery *b, gboolean changes, GSourceFunc func, gpointer data)
+{
+    UeventWatch *w;
+    int fd;
+
+    fd = battery_monitor_open ();
+    if (fd < 0) return 0;
+
+    w = g_new0 (UeventWatch, 1);
+    w->fd = fd;
+    w->b = b;
+    w->changes = changes;
+    w->func = func;
+    w->data = data;
+    return g_unix_fd_add_full (G_PRIORITY_DEFAULT, fd, G_IO_IN, uevent_event, w, uevent_unwatch);
+}
+
+#endif
+
+#if HAVE_BACKEND(BATT_BACKEND_SYSFS)
+
+/* sysfs - one read per attribute the driver exports, with the uevent socket
+ * only watched for the battery being taken out and put back */
+
+static gboolean sysfs_sample (gpointer handle, BattSnapshot *snap)
+{
+    battery *b = (battery *) handle;
+
+    if (battery_update (b)) battery_snapshot (b, snap);
+    else if (b->removed) absent_snapshot (snap);
+    else return FALSE;
+    return TRUE;
+}
+
+/* Read ahead for the next sample in the same pass as the peripherals given,
+ * which are always read through their uevent files */
+
+static void sysfs_fetch (gpointer handle, GList *others)
+{
+    GList self = { handle, others, NULL };
+
+    battery_fetch (&self, FALSE);
+}
+
+static guint sysfs_subscribe (gpointer handle, GSourceFunc func, gpointer data)
+{
+    return supply_watch ((battery *) handle, FALSE, func, data);
+}
+
+#endif
+
+#if HAVE_BACKEND(BATT_BACKEND_UEVENT)
+
+/* uevent - one read of the uevent file for all attributes, and notification
+ * of changes through the kernel's uevent socket */
+
+#define uevent_open sysfs_open
+#define uevent_ident sysfs_ident
+#define uevent_close sysfs_close
+
+static gboolean uevent_sample (gpointer handle, BattSnapshot *snap)
+{
+    battery *b = (battery *) handle;
+
+    if (battery_update_uevent (b)) battery_snapshot (b, snap);
+    else if (b->removed) absent_snapshot (snap);
+    else return FALSE;
+    return TRUE;
+}
+
+static void uevent_fetch (gpointer handle, GList *others)
+{
+    GList self = { handle, others, NULL };
+
+    battery_fetch (&self, TRUE);
+}
+
+static guint uevent_subscribe (gpointer handle, GSourceFunc func, gpointer data)
+{
+    return supply_watch ((battery *) handle, TRUE, func, data);
+}
+
+#endif
+
+#if HAVE_BACKEND(BATT_BACKEND_SIM)
+
+/* sim - cycles through charging and discharging, for testing the display */
+
+static gpointer sim_open (int)
+{
+    return g_new0 (SimBattery, 1);
+}
+
+static gboolean sim_sample (gpointer handle, BattSnapshot *snap)
+{
+    SimBattery *sim = (SimBattery *) handle;
+
+    if (sim->level < 100) sim->level += 5;
+    else sim->level = -100;
+
+    if (sim->level < 0) snap->status = STAT_DISCHARGING;
+    else if (sim->level == 100) snap->status = STAT_EXT_POWER;
+    else snap->status = STAT_CHARGING;
+
+    snap->percentage = sim->level < 0 ? -sim->level : sim->level;
+    snap->seconds = 30 * 60;
+    snap->power = -1;
+    snap->voltage = -1;
+    snap->full = -1;
+    snap->design = -1;
+    return TRUE;
+}
+
+static const char *sim_ident (gpointer)
+{
+    return NULL;
+}
+
+static void sim_close (gpointer handle)
+{
+    g_free (handle);
+}
+
+#endif
+
+#if HAVE_BACKEND(BATT_BACKEND_REPLAY)
+
+/* replay - steps through readings recorded in the file named by the
+ * PLUGIN_BATT_REPLAY environment variable, one per line, as
+ *     <status> <percentage> <seconds> [<power mW> <voltage mV>]
+ * where status is charging, discharging or full. */
+
+static gpointer replay_open (int)
+{
+    const char *file = g_getenv ("PLUGIN_BATT_REPLAY");
+    gchar *contents, **lines, **line;
+    char status[16];
+    int power, voltage;
+    BattSnapshot *snap;
+    Replay *rep;
+
+    if (!file || !g_file_get_contents (file, &contents, NULL, NULL))
+    {
+        g_message ("batt: no replay file to read");
+        return NULL;
+    }
+
+    lines = g_strsplit (contents, "\n", -1);
+    g_free (contents);
+
+    rep = g_new0 (Replay, 1);
+    rep->snaps = g_new0 (BattSnapshot, g_strv_length (lines));
+    for (line = lines; *line; line++)
+    {
+        snap = &rep->snaps[rep->count];
+        power = voltage = -1;
+        snap->full = -1;
+        snap->design = -1;
+        if (**line == '#' || sscanf (*line, "%15s %d %d %d %d", status, &snap->percentage,
+            &snap->seconds, &power, &voltage) < 3) continue;
+        snap->power = power >= 0 ? power * G_GINT64_CONSTANT (1000) : -1;
+        snap->voltage = voltage >= 0 ? voltage * G_GINT64_CONSTANT (1000) : -1;
+
+        if (!strcasecmp (status, "charging")) snap->status = STAT_CHARGING;
+        else if (!strcasecmp (status, "full")) snap->status = STAT_EXT_POWER;
+        else snap->status = STAT_DISCHARGING;
+        rep->count++;
+    }
+    g_strfreev (lines);
+
+    if (rep->count == 0)
+    {
+        g_message ("batt: no readings in replay file %s", file);
+        g_free (rep->snaps);
+        g_free (rep);
+        return NULL;
+    }
+    return rep;
+}
+
+static gboolean replay_sample (gpointer handle, BattSnapshot *snap)
+{
+    Replay *rep = (Replay *) handle;
+    gint64 time = snap->time;
+
+    *snap = rep->snaps[rep->pos];
+    snap->time = time;
+    if (++rep->pos == rep->count) rep->pos = 0;
+    return TRUE;
+}
+
+static const char *replay_ident (gpointer)
+{
+    return NULL;
+}
+
+static void replay_close (gpointer handle)
+{
+    Replay *rep = (Replay *) handle;
+
+    g_free (rep->snaps);
+    g_free (rep);
+}
+
+#endif
+
+static const BattBackend backends[] = {
+#if HAVE_BACKEND(BATT_BACKEND_SYSFS)
+    { "sysfs", 0, sysfs_open, sysfs_sample, sysfs_fetch, sysfs_subscribe, sysfs_ident, sysfs_close },
+#endif
+#if HAVE_BACKEND(BATT_BACKEND_UEVENT)
+    { "uevent", 0, uevent_open, uevent_sample, uevent_fetch, uevent_subscribe, uevent_ident, uevent_close },
+#endif
+#if HAVE_BACKEND(BATT_BACKEND_SIM)
+    { "sim", SIM_INTERVAL, sim_open, sim_sample, NULL, NULL, sim_ident, sim_close },
+#endif
+#if HAVE_BACKEND(BATT_BACKEND_REPLAY)
+    { "replay", SIM_INTERVAL, replay_open, replay_sample, NULL, NULL, replay_ident, replay_close },
+#endif
+};
+
+/* Open the named backend, or the first one if the name is not recognised */
+
+gboolean batt_source_open (BattSource *src, const char *name, int num)
+{
+    unsigned int i;
+
+    src->ops = &backends[0];
+    for (i = 0; name && i < G_N_ELEMENTS (backends); i++)
+        if (!strcmp (name, backends[i].name)) src->ops = &backends[i];
+    if (name && strcmp (name, src->ops->name))
+        g_message ("batt: backend %s not available, using %s", name, src->ops->name);
+
+    src->handle = src->ops->open (num);
+    if (src->handle) return TRUE;
+
+    src->ops = NULL;
+    return FALSE;
+}
+
+/* Take a reading - when built for a single backend, this is a direct call */
+
+gboolean batt_source_sample (BattSource *src, BattSnapshot *snap)
+{
+    snap->time = g_get_monotonic_time ();
+#ifdef BATT_BACKEND_ONLY
+    return ONLY (sample) (src->handle, snap);
+#else
+    return src->ops->sample (src->handle, snap);
+#endif
+}
+
+/* Read ahead for the next sample, in one pass with the peripheral batteries
+ * given - backends with nothing to read leave the peripherals to be read alone */
+
+void batt_source_fetch (BattSource *src, GList *others)
+{
+    if (src->ops && src->ops->fetch) src->ops->fetch (src->handle, others);
+    else battery_fetch (others, TRUE);
+}
+
+/* Ask to be called when the battery changes - returns a GLib source id to be
+ * removed by the caller, or 0 if the backend can only be polled */
+
+guint batt_source_subscribe (BattSource *src, GSourceFunc func, gpointer data)
+{
+    if (!src->ops->subscribe) return 0;
+    return src->ops->subscribe (src->handle, func, data);
+}
+
+/* Identity under which to keep statistics, or NULL for synthetic sources */
+
+const char *batt_source_ident (BattSource *src)
+{
+    return src->ops->ident (src->handle);
+}
+
+void batt_source_close (BattSource *src)
+{
+    if (!src->ops) return;
+    src->ops->close (src->handle);
+    src->ops = NULL;
+    src->handle = NULL;
+}
+
+/* End of file */
+/*----------------------------------------------------------------------------*/
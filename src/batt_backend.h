@@ -0,0 +1,100 @@
+/*============================================================================
+Copyright (c) 2025 Raspberry Pi Holdings Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+============================================================================*/
+
+#ifndef BATT_BACKEND_H
+#define BATT_BACKEND_H
+
+#include <glib.h>
+
+/*----------------------------------------------------------------------------*/
+/* Typedefs and macros                                                        */
+/*----------------------------------------------------------------------------*/
+
+/* Backends - building with BATT_BACKEND_ONLY set to one of these compiles in
+ * just that backend, and calls it directly rather than through the table */
+#define BATT_BACKEND_SYSFS  1
+#define BATT_BACKEND_UEVENT 2
+#define BATT_BACKEND_SIM    3
+#define BATT_BACKEND_REPLAY 4
+
+/* Battery states */
+typedef enum
+{
+    STAT_UNKNOWN = -1,
+    STAT_DISCHARGING = 0,
+    STAT_CHARGING = 1,
+    STAT_EXT_POWER = 2,
+    STAT_ABSENT = 3
+} status_t;
+
+/* One reading of the battery */
+typedef struct
+{
+    status_t status;
+    int percentage;                 /* 0-100 */
+    int seconds;                    /* Time to full or empty, -1 if unknown */
+    gint64 power;                   /* Power draw in uW, -1 if unknown */
+    gint64 voltage;                 /* Voltage in uV, -1 if unknown */
+    gint64 full;                    /* Full capacity in uAh or uWh, -1 if unknown */
+    gint64 design;                  /* Design capacity in the same units, -1 if unknown */
+    gint64 time;                    /* Monotonic time of the reading, in us */
+} BattSnapshot;
+
+typedef struct
+{
+    const char *name;
+    guint interval;                 /* Sampling interval in ms, 0 for the default */
+    gpointer (*open) (int num);
+    gboolean (*sample) (gpointer handle, BattSnapshot *snap);
+    void (*fetch) (gpointer handle, GList *others);  /* Read ahead with others, NULL if nothing is read */
+    guint (*subscribe) (gpointer handle, GSourceFunc func, gpointer data);
+    const char *(*ident) (gpointer handle);
+    void (*close) (gpointer handle);
+} BattBackend;
+
+/* An open backend */
+typedef struct
+{
+    const BattBackend *ops;
+    gpointer handle;
+} BattSource;
+
+/*----------------------------------------------------------------------------*/
+/* Prototypes                                                                 */
+/*----------------------------------------------------------------------------*/
+
+extern gboolean batt_source_open (BattSource *src, const char *name, int num);
+extern gboolean batt_source_sample (BattSource *src, BattSnapshot *snap);
+extern void batt_source_fetch (BattSource *src, GList *others);
+extern guint batt_source_subscribe (BattSource *src, GSourceFunc func, gpointer data);
+extern const char *batt_source_ident (BattSource *src);
+extern void batt_source_close (BattSource *src);
+
+#endif
+
+/* End of file */
+/*----------------------------------------------------------------------------*/
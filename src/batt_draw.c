@@ -0,0 +1,234 @@
+/*============================================================================
+Copyright (c) 2025 Raspberry Pi Holdings Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+============================================================================*/
+
+#include <string.h>
+#include <gdk/gdk.h>
+#include "batt_draw.h"
+
+/*----------------------------------------------------------------------------*/
+/* Prototypes                                                                 */
+/*----------------------------------------------------------------------------*/
+
+static guint32 argb_pixel (float r, float g, float b, float a);
+static void fill_rect (unsigned char *data, int stride, int sw, int sh, int x, int y, int w, int h, guint32 pixel);
+static inline guint32 mul_un8 (guint32 c, guint32 f);
+static void blend_symbol (unsigned char *data, int stride, int sw, int sh, cairo_surface_t *sym, int x, int y);
+static cairo_surface_t *load_symbol (const char *file);
+static cairo_surface_t *paint_icon (BattIcon *icon, int w, int h, int lev, float r, float g, float b, cairo_surface_t *sym);
+
+/*----------------------------------------------------------------------------*/
+/* Function definitions                                                       */
+/*----------------------------------------------------------------------------*/
+
+/* Convert a colour to a premultiplied ARGB32 pixel, rounding as cairo does */
+
+static guint32 argb_pixel (float r, float g, float b, float a)
+{
+    return ((guint32) (a * 65535.0 + 0.5) >> 8) << 24
+        | ((guint32) (r * a * 65535.0 + 0.5) >> 8) << 16
+        | ((guint32) (g * a * 65535.0 + 0.5) >> 8) << 8
+        | ((guint32) (b * a * 65535.0 + 0.5) >> 8);
+}
+
+/* Fill a pixel-aligned rectangle of the icon surface directly, rather than
+ * having cairo build, fill and free a path for each one - clipped to the
+ * surface, as at small sizes some of the rectangles fall outside it */
+
+static void fill_rect (unsigned char *data, int stride, int sw, int sh, int x, int y, int w, int h, guint32 pixel)
+{
+    int i, j, x1 = MIN (x + w, sw), y1 = MIN (y + h, sh);
+    guint32 *row;
+
+    for (j = MAX (y, 0); j < y1; j++)
+    {
+        row = (guint32 *) (data + j * stride);
+        for (i = MAX (x, 0); i < x1; i++) row[i] = pixel;
+    }
+}
+
+/* Scale an 8-bit channel by an 8-bit factor, rounding as pixman does */
+
+static inline guint32 mul_un8 (guint32 c, guint32 f)
+{
+    guint32 t = c * f + 0x80;
+    return (t + (t >> 8)) >> 8;
+}
+
+/* Composite one of the symbols over the icon with its top left at x, y,
+ * clipped to the surface - both are premultiplied, so this is the source
+ * plus the destination scaled by what the source leaves uncovered */
+
+static void blend_symbol (unsigned char *data, int stride, int sw, int sh, cairo_surface_t *sym, int x, int y)
+{
+    const unsigned char *src = cairo_image_surface_get_data (sym);
+    int sstride = cairo_image_surface_get_stride (sym);
+    int i, j, x1 = MIN (x + cairo_image_surface_get_width (sym), sw), y1 = MIN (y + cairo_image_surface_get_height (sym), sh);
+    guint32 s, d, ia, *row;
+    const guint32 *srow;
+
+    for (j = MAX (y, 0); j < y1; j++)
+    {
+        row = (guint32 *) (data + j * stride);
+        srow = (const guint32 *) (src + (j - y) * sstride);
+        for (i = MAX (x, 0); i < x1; i++)
+        {
+            s = srow[i - x];
+            ia = 255 - (s >> 24);
+            if (ia == 255) continue;
+            d = row[i];
+            row[i] = s + (mul_un8 (d >> 24, ia) << 24 | mul_un8 ((d >> 16) & 0xff, ia) << 16
+                | mul_un8 ((d >> 8) & 0xff, ia) << 8 | mul_un8 (d & 0xff, ia));
+        }
+    }
+}
+
+/* Load one of the overlay symbols into a surface, so it can be painted without conversion */
+
+static cairo_surface_t *load_symbol (const char *file)
+{
+    GdkPixbuf *pixbuf = file ? gdk_pixbuf_new_from_file (file, NULL) : NULL;
+    cairo_surface_t *surface;
+    cairo_t *cr;
+
+    if (!pixbuf) return NULL;
+    surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, gdk_pixbuf_get_width (pixbuf), gdk_pixbuf_get_height (pixbuf));
+    cr = cairo_create (surface);
+    gdk_cairo_set_source_pixbuf (cr, pixbuf, 0, 0);
+    cairo_paint (cr);
+    cairo_destroy (cr);
+    g_object_unref (pixbuf);
+
+    // the pixels are read directly from here on
+    cairo_surface_flush (surface);
+    return surface;
+}
+
+/* Load the symbols overlaid on the icon */
+
+void batt_icon_init (BattIcon *icon, const char *plug, const char *flash)
+{
+    memset (icon, 0, sizeof (BattIcon));
+    icon->plug = load_symbol (plug);
+    icon->flash = load_symbol (flash);
+}
+
+/* Calculate the dimensions of the icon for a panel icon size */
+
+void batt_icon_dims (int size, int *w, int *h)
+{
+    *w = size < 36 ? 36 : size;
+    *h = ((*w * 10) / 36) * 2; // force it to be even
+    if (*h < 18) *h = 18;
+    if (*h >= size) *h = size - 2;
+}
+
+/* Paint the icon onto the drawing surface in relevant colour and fill level */
+
+static cairo_surface_t *paint_icon (BattIcon *icon, int w, int h, int lev, float r, float g, float b, cairo_surface_t *sym)
+{
+    int f, stride;
+    guint32 solid, edge;
+    unsigned char *data;
+
+    if (w <= 0 || h <= 0) return NULL;
+
+    // the drawing surface is kept between draws, and only recreated when the size changes
+    if (!icon->surface || cairo_image_surface_get_width (icon->surface) != w || cairo_image_surface_get_height (icon->surface) != h)
+    {
+        if (icon->surface) cairo_surface_destroy (icon->surface);
+        icon->surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, w, h);
+    }
+
+    // clear the surface
+    cairo_surface_flush (icon->surface);
+    data = cairo_image_surface_get_data (icon->surface);
+    if (!data) return NULL;
+    stride = cairo_image_surface_get_stride (icon->surface);
+    memset (data, 0, stride * h);
+
+    // draw base icon on surface
+    solid = argb_pixel (r, g, b, 1.0);
+    fill_rect (data, stride, w, h, 4, 1, w - 10, 1, solid);
+    fill_rect (data, stride, w, h, 3, 2, w - 8, 1, solid);
+    fill_rect (data, stride, w, h, 3, h - 3, w - 8, 1, solid);
+    fill_rect (data, stride, w, h, 4, h - 2, w - 10, 1, solid);
+    fill_rect (data, stride, w, h, 2, 3, 2, h - 6, solid);
+    fill_rect (data, stride, w, h, w - 6, 3, 2, h - 6, solid);
+    fill_rect (data, stride, w, h, w - 4, (h >> 1) - 3, 2, 6, solid);
+
+    edge = argb_pixel (r, g, b, 0.5);
+    fill_rect (data, stride, w, h, 3, 1, 1, 1, edge);
+    fill_rect (data, stride, w, h, 2, 2, 1, 1, edge);
+    fill_rect (data, stride, w, h, 2, h - 3, 1, 1, edge);
+    fill_rect (data, stride, w, h, 3, h - 2, 1, 1, edge);
+    fill_rect (data, stride, w, h, w - 6, 1, 1, 1, edge);
+    fill_rect (data, stride, w, h, w - 5, 2, 1, 1, edge);
+    fill_rect (data, stride, w, h, w - 5, h - 3, 1, 1, edge);
+    fill_rect (data, stride, w, h, w - 6, h - 2, 1, 1, edge);
+
+    // fill the battery
+    if (lev < 0) f = 0;
+    else if (lev > 97) f = w - 12;
+    else
+    {
+        f = (w - 12) * lev;
+        f /= 97;
+        if (f > w - 12) f = w - 12;
+    }
+    fill_rect (data, stride, w, h, 5, 4, f, h - 8, solid);
+
+    // show icons - the flash is a pixel left of centre
+    if (sym) blend_symbol (data, stride, w, h, sym, (w >> 1) - (sym == icon->flash ? 15 : 16), (h >> 1) - 16);
+
+    cairo_surface_mark_dirty (icon->surface);
+    return icon->surface;
+}
+
+/* Paint the icon in the colour for the charging state - returns the surface
+ * painted, or NULL if there is nothing to paint at that size */
+
+cairo_surface_t *batt_icon_paint (BattIcon *icon, int w, int h, status_t status, int lev)
+{
+    if (status == STAT_ABSENT) return paint_icon (icon, w, h, -1, 0.5, 0.5, 0.5, NULL);
+    else if (status == STAT_CHARGING) return paint_icon (icon, w, h, lev, 0.95, 0.64, 0, icon->flash);
+    else if (status == STAT_EXT_POWER) return paint_icon (icon, w, h, lev, 0, 0.85, 0, icon->plug);
+    else if (lev <= CRITICAL_LEVEL) return paint_icon (icon, w, h, lev, 1, 0, 0, NULL);
+    else return paint_icon (icon, w, h, lev, 0, 0.85, 0, NULL);
+}
+
+/* Release the surfaces */
+
+void batt_icon_free (BattIcon *icon)
+{
+    if (icon->surface) cairo_surface_destroy (icon->surface);
+    if (icon->plug) cairo_surface_destroy (icon->plug);
+    if (icon->flash) cairo_surface_destroy (icon->flash);
+    memset (icon, 0, sizeof (BattIcon));
+}
+
+/* End of file */
+/*----------------------------------------------------------------------------*/
@@ -0,0 +1,63 @@
+/*============================================================================
+Copyright (c) 2025 Raspberry Pi Holdings Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+============================================================================*/
+
+#ifndef BATT_DRAW_H
+#define BATT_DRAW_H
+
+#include <cairo.h>
+#include "batt_backend.h"
+
+/*----------------------------------------------------------------------------*/
+/* Typedefs and macros                                                        */
+/*----------------------------------------------------------------------------*/
+
+/* At or below this level when discharging, the icon is drawn in red */
+#define CRITICAL_LEVEL 20
+
+/* The battery icon, drawn straight into the pixels of an image surface -
+ * once the surface exists for a size, painting allocates nothing. Needs no
+ * display, so can be driven offscreen. */
+typedef struct
+{
+    cairo_surface_t *surface;       /* Drawing surface, reused until the size changes */
+    cairo_surface_t *plug;          /* Symbol shown on external power */
+    cairo_surface_t *flash;         /* Symbol shown while charging */
+} BattIcon;
+
+/*----------------------------------------------------------------------------*/
+/* Prototypes                                                                 */
+/*----------------------------------------------------------------------------*/
+
+extern void batt_icon_init (BattIcon *icon, const char *plug, const char *flash);
+extern void batt_icon_dims (int size, int *w, int *h);
+extern cairo_surface_t *batt_icon_paint (BattIcon *icon, int w, int h, status_t status, int lev);
+extern void batt_icon_free (BattIcon *icon);
+
+#endif
+
+/* End of file */
+/*----------------------------------------------------------------------------*/
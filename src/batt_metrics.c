@@ -0,0 +1,289 @@
+/*============================================================================
+Copyright (c) 2025 Raspberry Pi Holdings Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+============================================================================*/
+
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#include <gio/gunixsocketaddress.h>
+#include "batt_metrics.h"
+
+/*----------------------------------------------------------------------------*/
+/* Typedefs and macros                                                        */
+/*----------------------------------------------------------------------------*/
+
+#define RESPONSE_HEADER "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n" \
+    "Content-Length: %" G_GSIZE_FORMAT "\r\nConnection: close\r\n\r\n"
+
+/* Longest request read - anything past this is not waited for */
+#define REQUEST_MAX 4096
+
+/* A request being read, then its response being written */
+typedef struct
+{
+    BattMetrics *m;                 /* Only valid while cancel is not set */
+    GCancellable *cancel;
+    GSocketConnection *conn;
+    char request[REQUEST_MAX];
+    gsize len;
+    GString *text;
+} MetricsReply;
+
+/*----------------------------------------------------------------------------*/
+/* Prototypes                                                                 */
+/*----------------------------------------------------------------------------*/
+
+static void put_metric (GString *s, const char *name, const char *type, const char *help, const char *id, const char *labels, double val);
+static void render (BattMetrics *m, GString *s);
+static gboolean incoming (GSocketService *, GSocketConnection *conn, GObject *, BattMetrics *m);
+static void read_request (MetricsReply *reply);
+static void request_read (GObject *stream, GAsyncResult *res, gpointer user_data);
+static void send_reply (MetricsReply *reply);
+static void reply_done (GObject *stream, GAsyncResult *res, gpointer user_data);
+static void reply_free (MetricsReply *reply);
+
+/*----------------------------------------------------------------------------*/
+/* Function definitions                                                       */
+/*----------------------------------------------------------------------------*/
+
+/* Append one sample, with its help and type lines if given - values are
+ * formatted without regard to the locale, as the format requires */
+
+static void put_metric (GString *s, const char *name, const char *type, const char *help, const char *id, const char *labels, double val)
+{
+    char num[G_ASCII_DTOSTR_BUF_SIZE];
+
+    if (help) g_string_append_printf (s, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    g_string_append_printf (s, "%s{battery=\"%s\"%s} %s\n", name, id, labels ? labels : "",
+        g_ascii_dtostr (num, sizeof (num), val));
+}
+
+/* Build the response from the last reading and the cost counters */
+
+static void render (BattMetrics *m, GString *s)
+{
+    const BattSnapshot *snap = m->snap;
+    const char *id = NULL;
+    gboolean up;
+
+    if (m->src->ops) id = batt_source_ident (m->src);
+    if (!id) id = m->src->ops ? m->src->ops->name : "";
+    up = m->src->ops && snap->status != STAT_UNKNOWN && snap->status != STAT_ABSENT;
+
+    put_metric (s, "batt_up", "gauge", "Whether a battery reading is available", id, NULL, up);
+    put_metric (s, "batt_present", "gauge", "Whether the battery is fitted", id, NULL, snap->status != STAT_ABSENT);
+    if (up)
+    {
+        put_metric (s, "batt_percentage", "gauge", "Charge level in percent", id, NULL, snap->percentage);
+        put_metric (s, "batt_status", "gauge", "Charging state", id, ",status=\"discharging\"", snap->status == STAT_DISCHARGING);
+        put_metric (s, "batt_status", "gauge", NULL, id, ",status=\"charging\"", snap->status == STAT_CHARGING);
+        put_metric (s, "batt_status", "gauge", NULL, id, ",status=\"external\"", snap->status == STAT_EXT_POWER);
+        if (snap->seconds >= 0)
+            put_metric (s, "batt_time_remaining_seconds", "gauge", "Time to full or empty", id, NULL, snap->seconds);
+        if (snap->power >= 0)
+            put_metric (s, "batt_power_watts", "gauge", "Power draw", id, NULL, snap->power / 1e6);
+        if (snap->voltage >= 0)
+            put_metric (s, "batt_voltage_volts", "gauge", "Voltage", id, NULL, snap->voltage / 1e6);
+        if (snap->full >= 0)
+            put_metric (s, "batt_full_capacity", "gauge", "Full capacity in uAh or uWh, as reported by the driver", id, NULL, snap->full);
+        if (snap->design >= 0)
+            put_metric (s, "batt_design_capacity", "gauge", "Design capacity in the same units", id, NULL, snap->design);
+    }
+    if (m->stats->file)
+    {
+        put_metric (s, "batt_cycles_total", "counter", "Charge cycles started", id, NULL, m->stats->cycles);
+        if (m->stats->wear >= 0)
+            put_metric (s, "batt_health_ratio", "gauge", "Full capacity as a fraction of design", id, NULL, (100 - m->stats->wear) / 100.0);
+        put_metric (s, "batt_energy_drawn_wh_total", "counter", "Energy drawn from the battery", id, NULL, m->stats->total_drawn / 1e6);
+        put_metric (s, "batt_energy_charged_wh_total", "counter", "Energy put into the battery", id, NULL, m->stats->total_charged / 1e6);
+        put_metric (s, "batt_energy_drawn_wh", "gauge", "Energy drawn over a period", id, ",period=\"session\"", m->stats->session_drawn / 1e6);
+        put_metric (s, "batt_energy_drawn_wh", "gauge", NULL, id, ",period=\"day\"", m->stats->day_drawn / 1e6);
+        put_metric (s, "batt_energy_charged_wh", "gauge", "Energy charged over a period", id, ",period=\"session\"", m->stats->session_charged / 1e6);
+        put_metric (s, "batt_energy_charged_wh", "gauge", NULL, id, ",period=\"day\"", m->stats->day_charged / 1e6);
+    }
+
+    put_metric (s, "batt_samples_total", "counter", "Readings taken by the plugin", id, NULL, m->samples);
+    put_metric (s, "batt_sample_seconds_total", "counter", "Time spent taking readings", id, NULL, m->sample_us / 1e6);
+    put_metric (s, "batt_renders_total", "counter", "Icons drawn by the plugin", id, NULL, m->renders);
+    put_metric (s, "batt_render_seconds_total", "counter", "Time spent drawing icons", id, NULL, m->render_us / 1e6);
+    put_metric (s, "batt_frames_total", "counter", "Charging animation frames shown", id, NULL, m->frames);
+    put_metric (s, "batt_frame_seconds_total", "counter", "Time spent showing animation frames", id, NULL, m->frame_us / 1e6);
+    put_metric (s, "batt_scrapes_total", "counter", "Metrics responses served", id, NULL, ++m->scrapes);
+}
+
+/* Handler for a client connecting - the request is read to the end of its
+ * headers before answering, so the connection is not closed with input
+ * unread, which would reset it rather than end it cleanly. The request
+ * itself is not looked at - every path gets the metrics. */
+
+static gboolean incoming (GSocketService *, GSocketConnection *conn, GObject *, BattMetrics *m)
+{
+    MetricsReply *reply = g_new0 (MetricsReply, 1);
+
+    reply->m = m;
+    reply->cancel = g_object_ref (m->cancel);
+    reply->conn = g_object_ref (conn);
+    read_request (reply);
+    return TRUE;
+}
+
+static void read_request (MetricsReply *reply)
+{
+    g_input_stream_read_async (g_io_stream_get_input_stream (G_IO_STREAM (reply->conn)),
+        reply->request + reply->len, REQUEST_MAX - 1 - reply->len, G_PRIORITY_LOW, reply->cancel, request_read, reply);
+}
+
+static void request_read (GObject *stream, GAsyncResult *res, gpointer user_data)
+{
+    MetricsReply *reply = (MetricsReply *) user_data;
+    gssize n = g_input_stream_read_finish (G_INPUT_STREAM (stream), res, NULL);
+
+    /* Stopped serving, or the client went away */
+    if (g_cancellable_is_cancelled (reply->cancel) || n < 0)
+    {
+        reply_free (reply);
+        return;
+    }
+
+    /* Keep reading until the blank line ending the headers, the client
+     * closing its side, or the buffer filling */
+    reply->len += n;
+    reply->request[reply->len] = 0;
+    if (n > 0 && reply->len < REQUEST_MAX - 1 && !strstr (reply->request, "\r\n\r\n"))
+    {
+        read_request (reply);
+        return;
+    }
+
+    send_reply (reply);
+}
+
+/* Build the response and write it asynchronously, then close the connection */
+
+static void send_reply (MetricsReply *reply)
+{
+    GString *body = g_string_new (NULL);
+
+    render (reply->m, body);
+    reply->text = g_string_sized_new (body->len + 160);
+    g_string_printf (reply->text, RESPONSE_HEADER, body->len);
+    g_string_append_len (reply->text, body->str, body->len);
+    g_string_free (body, TRUE);
+
+    g_output_stream_write_all_async (g_io_stream_get_output_stream (G_IO_STREAM (reply->conn)),
+        reply->text->str, reply->text->len, G_PRIORITY_LOW, NULL, reply_done, reply);
+}
+
+static void reply_done (GObject *stream, GAsyncResult *res, gpointer user_data)
+{
+    MetricsReply *reply = (MetricsReply *) user_data;
+
+    /* A client going away early is not worth reporting */
+    g_output_stream_write_all_finish (G_OUTPUT_STREAM (stream), res, NULL, NULL);
+    reply_free (reply);
+}
+
+static void reply_free (MetricsReply *reply)
+{
+    g_io_stream_close_async (G_IO_STREAM (reply->conn), G_PRIORITY_LOW, NULL, NULL, NULL);
+    g_object_unref (reply->conn);
+    g_object_unref (reply->cancel);
+    if (reply->text) g_string_free (reply->text, TRUE);
+    g_free (reply);
+}
+
+/* Start serving on the given socket path - relative paths are taken from the
+ * user's runtime directory */
+
+gboolean batt_metrics_start (BattMetrics *m, const char *path, BattSource *src, const BattSnapshot *snap, const BattStats *stats)
+{
+    GSocketAddress *addr;
+    GError *err = NULL;
+    GStatBuf st;
+
+    m->path = g_path_is_absolute (path) ? g_strdup (path) : g_build_filename (g_get_user_runtime_dir (), path, NULL);
+    m->src = src;
+    m->snap = snap;
+    m->stats = stats;
+
+    /* A socket left over from a previous run would stop the bind - but
+     * anything else at the path is not ours to remove */
+    if (g_lstat (m->path, &st) == 0)
+    {
+        if (!S_ISSOCK (st.st_mode))
+        {
+            g_message ("batt: cannot serve metrics on %s : not a socket", m->path);
+            batt_metrics_stop (m);
+            return FALSE;
+        }
+        g_unlink (m->path);
+    }
+
+    m->cancel = g_cancellable_new ();
+    m->service = g_socket_service_new ();
+    addr = g_unix_socket_address_new (m->path);
+    if (!g_socket_listener_add_address (G_SOCKET_LISTENER (m->service), addr, G_SOCKET_TYPE_STREAM,
+        G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, &err))
+    {
+        g_message ("batt: cannot serve metrics on %s : %s", m->path, err->message);
+        g_error_free (err);
+        g_object_unref (addr);
+        batt_metrics_stop (m);
+        return FALSE;
+    }
+    g_object_unref (addr);
+
+    g_signal_connect (m->service, "incoming", G_CALLBACK (incoming), m);
+    g_socket_service_start (m->service);
+    return TRUE;
+}
+
+/* Stop serving and remove the socket */
+
+void batt_metrics_stop (BattMetrics *m)
+{
+    if (!m->path) return;
+
+    if (m->service)
+    {
+        g_socket_service_stop (m->service);
+        g_socket_listener_close (G_SOCKET_LISTENER (m->service));
+        g_object_unref (m->service);
+        m->service = NULL;
+        g_unlink (m->path);
+    }
+    if (m->cancel)
+    {
+        g_cancellable_cancel (m->cancel);
+        g_object_unref (m->cancel);
+        m->cancel = NULL;
+    }
+    g_free (m->path);
+    m->path = NULL;
+}
+
+/* End of file */
+/*----------------------------------------------------------------------------*/
@@ -0,0 +1,72 @@
+/*============================================================================
+Copyright (c) 2025 Raspberry Pi Holdings Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+============================================================================*/
+
+#ifndef BATT_METRICS_H
+#define BATT_METRICS_H
+
+#include <gio/gio.h>
+#include "batt_backend.h"
+#include "batt_stats.h"
+
+/*----------------------------------------------------------------------------*/
+/* Typedefs and macros                                                        */
+/*----------------------------------------------------------------------------*/
+
+/* Metrics served on a Unix socket in Prometheus text format, e.g.
+ *     curl --unix-socket $XDG_RUNTIME_DIR/batt.sock http://localhost/metrics
+ * Every response is built from the last reading - scrapes never touch the
+ * battery. */
+typedef struct
+{
+    GSocketService *service;        /* Listening socket, NULL if not serving */
+    gchar *path;                    /* Socket path, removed on stop */
+    GCancellable *cancel;           /* Cancels requests still being read on stop */
+    BattSource *src;                /* Source of the readings, for its name */
+    const BattSnapshot *snap;       /* Last reading */
+    const BattStats *stats;         /* Health and wear analytics */
+
+    /* Cost of the plugin itself */
+    guint64 samples;                /* Readings taken */
+    guint64 sample_us;              /* Time spent taking them */
+    guint64 renders;                /* Icons drawn */
+    guint64 render_us;              /* Time spent drawing them */
+    guint64 frames;                 /* Animation frames shown */
+    guint64 frame_us;               /* Time spent showing them */
+    guint64 scrapes;                /* Responses served */
+} BattMetrics;
+
+/*----------------------------------------------------------------------------*/
+/* Prototypes                                                                 */
+/*----------------------------------------------------------------------------*/
+
+extern gboolean batt_metrics_start (BattMetrics *m, const char *path, BattSource *src, const BattSnapshot *snap, const BattStats *stats);
+extern void batt_metrics_stop (BattMetrics *m);
+
+#endif
+
+/* End of file */
+/*----------------------------------------------------------------------------*/
@@ -0,0 +1,380 @@
+/*============================================================================
+Copyright (c) 2025 Raspberry Pi Holdings Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+============================================================================*/
+
+#include <string.h>
+#include <time.h>
+#include <glib/gstdio.h>
+#include "batt_stats.h"
+
+/*----------------------------------------------------------------------------*/
+/* Typedefs and macros                                                        */
+/*----------------------------------------------------------------------------*/
+
+#define STATS_DIR "batt"
+#define HEALTH_GROUP "Health"
+#define PROFILE_GROUP "Profile"
+#define ENERGY_GROUP "Energy"
+
+/* Larger jumps in percentage than this are taken to be a gap in sampling,
+ * rather than a fast step, and are not learned from */
+#define PROFILE_MAX_JUMP 5
+
+/* Power readings further apart than this, in us, are not integrated across */
+#define ENERGY_MAX_GAP (300 * G_USEC_PER_SEC)
+
+/* Power readings above this, in uW, are taken to be a driver fault - it also
+ * keeps the sum of two readings over the longest gap within 64 bits */
+#define ENERGY_MAX_POWER G_GINT64_CONSTANT (10000000000)
+
+/* While discharging, the statistics are saved this often, in us - a pack
+ * which runs flat powers the system off with no chance to save them */
+#define SAVE_PERIOD (300 * G_USEC_PER_SEC)
+
+/* Sum of two uW readings times us to uWh - halved for the mean, and an hour */
+#define ENERGY_DIVISOR (G_GINT64_CONSTANT (2) * 3600 * G_USEC_PER_SEC)
+
+/*----------------------------------------------------------------------------*/
+/* Prototypes                                                                 */
+/*----------------------------------------------------------------------------*/
+
+static void profile_sum (BattStats *s);
+static void profile_learn (BattStats *s, const BattSnapshot *snap);
+static void energy_integrate (BattStats *s, const BattSnapshot *snap);
+
+/*----------------------------------------------------------------------------*/
+/* Function definitions                                                       */
+/*----------------------------------------------------------------------------*/
+
+/* Load any stored statistics for the battery with the supplied identity */
+
+void batt_stats_init (BattStats *s, const char *id)
+{
+    GKeyFile *kf;
+    gint *list;
+    gsize len;
+
+    memset (s, 0, sizeof (BattStats));
+    s->full_min = -1;
+    s->full_max = -1;
+    s->design = -1;
+    s->full = -1;
+    s->wear = -1;
+    s->level = -1;
+    s->step_level = -1;
+    s->energy_power = -1;
+    s->energy_time = -1;
+    s->save_time = -1;
+
+    s->file = g_build_filename (g_get_user_data_dir (), STATS_DIR, id, NULL);
+
+    kf = g_key_file_new ();
+    if (g_key_file_load_from_file (kf, s->file, G_KEY_FILE_NONE, NULL))
+    {
+        s->cycles = g_key_file_get_integer (kf, HEALTH_GROUP, "Cycles", NULL);
+        s->drained = g_key_file_get_boolean (kf, HEALTH_GROUP, "Drained", NULL);
+        s->discharged = g_key_file_get_integer (kf, HEALTH_GROUP, "Discharged", NULL);
+        s->full_count = g_key_file_get_integer (kf, HEALTH_GROUP, "FullCount", NULL);
+        if (s->full_count > 0)
+        {
+            s->full_min = g_key_file_get_int64 (kf, HEALTH_GROUP, "FullMin", NULL);
+            s->full_max = g_key_file_get_int64 (kf, HEALTH_GROUP, "FullMax", NULL);
+            s->full_mean = g_key_file_get_double (kf, HEALTH_GROUP, "FullMean", NULL);
+            s->full = g_key_file_get_int64 (kf, HEALTH_GROUP, "Full", NULL);
+        }
+        list = g_key_file_get_integer_list (kf, PROFILE_GROUP, "Discharge", &len, NULL);
+        if (list && len == PROFILE_STEPS) memcpy (s->discharge, list, sizeof (s->discharge));
+        g_free (list);
+        list = g_key_file_get_integer_list (kf, PROFILE_GROUP, "Charge", &len, NULL);
+        if (list && len == PROFILE_STEPS) memcpy (s->charge, list, sizeof (s->charge));
+        g_free (list);
+        s->total_drawn = g_key_file_get_int64 (kf, ENERGY_GROUP, "TotalDrawn", NULL);
+        s->total_charged = g_key_file_get_int64 (kf, ENERGY_GROUP, "TotalCharged", NULL);
+        s->day = g_key_file_get_integer (kf, ENERGY_GROUP, "Day", NULL);
+        s->day_drawn = g_key_file_get_int64 (kf, ENERGY_GROUP, "DayDrawn", NULL);
+        s->day_charged = g_key_file_get_int64 (kf, ENERGY_GROUP, "DayCharged", NULL);
+    }
+    g_key_file_free (kf);
+
+    profile_sum (s);
+}
+
+/* Fold one sample into the statistics - constant time and no file access
+ * except at a cycle boundary, a change of day, or every few minutes of
+ * discharge */
+
+void batt_stats_update (BattStats *s, const BattSnapshot *snap)
+{
+    gboolean charging = snap->status == STAT_CHARGING;
+    int level = snap->percentage;
+    gint64 full = snap->full, design = snap->design;
+    double ratio;
+
+    if (!s->file) return;
+
+    /* Depth of discharge, so that partial cycles add up to equivalent full ones */
+    if (!charging && s->level >= 0 && level < s->level) s->discharged += s->level - level;
+
+    /* The driver only revises the full capacity at the end of a charge, so
+     * each change is a new sample of usable capacity */
+    if (full > 0 && full != s->full)
+    {
+        s->full = full;
+        s->full_count++;
+        s->full_mean += (full - s->full_mean) / s->full_count;
+        if (s->full_min < 0 || full < s->full_min) s->full_min = full;
+        if (full > s->full_max) s->full_max = full;
+    }
+
+    /* In floating point, as the capacities can be anything a driver reports */
+    s->design = design;
+    if (design > 0 && s->full > 0)
+    {
+        ratio = (double) s->full * 100 / design;
+        s->wear = ratio >= 100 ? 0 : 100 - (int) (ratio + 0.5);
+    }
+    else s->wear = -1;
+
+    /* Starting to charge after a discharge is a cycle boundary - chargers
+     * which stop and restart around a threshold move between full and
+     * charging with no discharge, and are not counted */
+    if (snap->status == STAT_DISCHARGING) s->drained = TRUE;
+    else if (charging && s->drained)
+    {
+        s->drained = FALSE;
+        s->cycles++;
+        batt_stats_save (s);
+    }
+
+    s->level = level;
+
+    profile_learn (s, snap);
+    energy_integrate (s, snap);
+
+    if (s->save_time < 0) s->save_time = snap->time;
+    else if (snap->status == STAT_DISCHARGING && snap->time - s->save_time >= SAVE_PERIOD)
+    {
+        s->save_time = snap->time;
+        batt_stats_save (s);
+    }
+}
+
+/* Rebuild the times to empty and full from the learned steps - only needed
+ * when a step is learned, so that estimates are a single lookup. Steps not
+ * yet seen are taken to be the average of those that have been. */
+
+static void profile_sum (BattStats *s)
+{
+    int i, nd = 0, nc = 0, td = 0, tc = 0;
+
+    for (i = 0; i < PROFILE_STEPS; i++)
+    {
+        if (s->discharge[i]) nd++, td += s->discharge[i];
+        if (s->charge[i]) nc++, tc += s->charge[i];
+    }
+
+    s->to_empty[0] = nd ? 0 : -1;
+    for (i = 0; i < PROFILE_STEPS; i++)
+        s->to_empty[i + 1] = nd ? s->to_empty[i] + (s->discharge[i] ? s->discharge[i] : td / nd) : -1;
+
+    s->to_full[PROFILE_STEPS] = nc ? 0 : -1;
+    for (i = PROFILE_STEPS - 1; i >= 0; i--)
+        s->to_full[i] = nc ? s->to_full[i + 1] + (s->charge[i] ? s->charge[i] : tc / nc) : -1;
+}
+
+/* Time how long each percentage step takes, and fold it into the profile */
+
+static void profile_learn (BattStats *s, const BattSnapshot *snap)
+{
+    int i, lo, n, dur, *steps;
+
+    if (snap->status != STAT_DISCHARGING && snap->status != STAT_CHARGING)
+    {
+        s->step_level = -1;
+        return;
+    }
+
+    /* Start timing - the first step is only seen part way through */
+    if (s->step_level < 0 || snap->status != s->step_status)
+    {
+        s->step_status = snap->status;
+        s->step_level = snap->percentage;
+        s->step_time = -1;
+        return;
+    }
+
+    n = snap->percentage - s->step_level;
+    if (n == 0) return;
+    if (snap->status == STAT_DISCHARGING) n = -n;
+
+    if (n > 0 && n <= PROFILE_MAX_JUMP && s->step_time >= 0)
+    {
+        dur = (snap->time - s->step_time) / (G_USEC_PER_SEC * n);
+        steps = snap->status == STAT_DISCHARGING ? s->discharge : s->charge;
+        lo = MIN (snap->percentage, s->step_level);
+        for (i = lo; i < lo + n && i < PROFILE_STEPS; i++)
+            steps[i] = steps[i] ? (steps[i] * 3 + dur) / 4 : dur;
+        profile_sum (s);
+    }
+
+    s->step_level = snap->percentage;
+    s->step_time = n > 0 && n <= PROFILE_MAX_JUMP ? snap->time : -1;
+}
+
+/* Add up the energy moved since the last power reading, taking the power to
+ * change linearly between readings. Nothing is added across a change of
+ * direction or a gap in readings, such as a suspend. */
+
+static void energy_integrate (BattStats *s, const BattSnapshot *snap)
+{
+    time_t now = time (NULL);
+    struct tm tm;
+    gint64 uwh;
+    int day;
+
+    /* The daily totals start again at local midnight */
+    localtime_r (&now, &tm);
+    day = (tm.tm_year + 1900) * 1000 + tm.tm_yday;
+    if (day != s->day)
+    {
+        s->day = day;
+        s->day_drawn = 0;
+        s->day_charged = 0;
+        batt_stats_save (s);
+    }
+
+    if (s->energy_time >= 0 && s->energy_power >= 0 && snap->power >= 0 && snap->power <= ENERGY_MAX_POWER
+        && snap->status == s->energy_status && snap->time - s->energy_time <= ENERGY_MAX_GAP)
+    {
+        /* uW over us to uWh, rounded */
+        uwh = ((s->energy_power + snap->power) * (snap->time - s->energy_time) + ENERGY_DIVISOR / 2) / ENERGY_DIVISOR;
+        if (snap->status == STAT_DISCHARGING)
+        {
+            s->total_drawn += uwh;
+            s->day_drawn += uwh;
+            s->session_drawn += uwh;
+        }
+        else if (snap->status == STAT_CHARGING)
+        {
+            s->total_charged += uwh;
+            s->day_charged += uwh;
+            s->session_charged += uwh;
+        }
+    }
+
+    s->energy_status = snap->status;
+    s->energy_power = snap->power;
+    s->energy_time = snap->power >= 0 && snap->power <= ENERGY_MAX_POWER ? snap->time : -1;
+}
+
+/* Estimate seconds to empty or full from the learned profile, allowing for
+ * the time already spent at the current percentage. Returns -1 if unknown. */
+
+int batt_stats_estimate (BattStats *s, const BattSnapshot *snap)
+{
+    int level = CLAMP (snap->percentage, 0, PROFILE_STEPS), eta, step, spent;
+
+    if (!s->file) return -1;
+
+    if (snap->status == STAT_DISCHARGING && s->to_empty[level] >= 0)
+    {
+        eta = s->to_empty[level];
+        step = level > 0 ? eta - s->to_empty[level - 1] : 0;
+    }
+    else if (snap->status == STAT_CHARGING && s->to_full[level] >= 0)
+    {
+        eta = s->to_full[level];
+        step = level < PROFILE_STEPS ? eta - s->to_full[level + 1] : 0;
+    }
+    else return -1;
+
+    if (s->step_level == snap->percentage && s->step_time >= 0)
+    {
+        spent = (snap->time - s->step_time) / G_USEC_PER_SEC;
+        eta -= MIN (spent, step);
+    }
+    return eta;
+}
+
+/* Forget the step being timed and the last power reading after a suspend -
+ * the monotonic clock stops while asleep, so the time across the gap would
+ * be far too short */
+
+void batt_stats_resume (BattStats *s)
+{
+    s->step_level = -1;
+    s->energy_time = -1;
+}
+
+/* Write the statistics to the persistent store */
+
+void batt_stats_save (BattStats *s)
+{
+    GKeyFile *kf;
+    gchar *dir;
+
+    if (!s->file) return;
+
+    dir = g_path_get_dirname (s->file);
+    g_mkdir_with_parents (dir, 0700);
+    g_free (dir);
+
+    kf = g_key_file_new ();
+    g_key_file_set_integer (kf, HEALTH_GROUP, "Cycles", s->cycles);
+    g_key_file_set_boolean (kf, HEALTH_GROUP, "Drained", s->drained);
+    g_key_file_set_integer (kf, HEALTH_GROUP, "Discharged", s->discharged);
+    g_key_file_set_integer (kf, HEALTH_GROUP, "FullCount", s->full_count);
+    if (s->full_count > 0)
+    {
+        g_key_file_set_int64 (kf, HEALTH_GROUP, "FullMin", s->full_min);
+        g_key_file_set_int64 (kf, HEALTH_GROUP, "FullMax", s->full_max);
+        g_key_file_set_double (kf, HEALTH_GROUP, "FullMean", s->full_mean);
+        g_key_file_set_int64 (kf, HEALTH_GROUP, "Full", s->full);
+    }
+    g_key_file_set_integer_list (kf, PROFILE_GROUP, "Discharge", s->discharge, PROFILE_STEPS);
+    g_key_file_set_integer_list (kf, PROFILE_GROUP, "Charge", s->charge, PROFILE_STEPS);
+    g_key_file_set_int64 (kf, ENERGY_GROUP, "TotalDrawn", s->total_drawn);
+    g_key_file_set_int64 (kf, ENERGY_GROUP, "TotalCharged", s->total_charged);
+    g_key_file_set_integer (kf, ENERGY_GROUP, "Day", s->day);
+    g_key_file_set_int64 (kf, ENERGY_GROUP, "DayDrawn", s->day_drawn);
+    g_key_file_set_int64 (kf, ENERGY_GROUP, "DayCharged", s->day_charged);
+    g_key_file_save_to_file (kf, s->file, NULL);
+    g_key_file_free (kf);
+}
+
+/* Save and release the statistics */
+
+void batt_stats_free (BattStats *s)
+{
+    if (!s->file) return;
+
+    batt_stats_save (s);
+    g_free (s->file);
+    s->file = NULL;
+}
+
+/* End of file */
+/*----------------------------------------------------------------------------*/
@@ -0,0 +1,97 @@
+/*============================================================================
+Copyright (c) 2025 Raspberry Pi Holdings Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+============================================================================*/
+
+#ifndef BATT_STATS_H
+#define BATT_STATS_H
+
+#include "batt_backend.h"
+
+/*----------------------------------------------------------------------------*/
+/* Typedefs and macros                                                        */
+/*----------------------------------------------------------------------------*/
+
+#define PROFILE_STEPS 100
+
+typedef struct
+{
+    gchar *file;                    /* Path to persistent store */
+
+    /* Persisted across sessions */
+    int cycles;                     /* Charges started after a discharge */
+    gboolean drained;               /* Discharged since the last cycle was counted */
+    int discharged;                 /* Cumulative discharge in percent; 100 = one full cycle */
+    gint64 full_min;                /* Smallest full capacity seen, in uAh or uWh */
+    gint64 full_max;                /* Largest full capacity seen */
+    double full_mean;               /* Running mean of full capacity */
+    int full_count;                 /* Number of full capacity samples */
+    int discharge[PROFILE_STEPS];   /* Learned seconds to fall from n+1% to n%, 0 if not seen */
+    int charge[PROFILE_STEPS];      /* Learned seconds to rise from n% to n+1%, 0 if not seen */
+    gint64 total_drawn;             /* Energy drawn from the battery, in uWh */
+    gint64 total_charged;           /* Energy put into the battery, in uWh */
+    int day;                        /* Local day of the daily totals, as year * 1000 + day of year */
+    gint64 day_drawn;               /* Energy drawn that day */
+    gint64 day_charged;             /* Energy charged that day */
+
+    /* Since the statistics were loaded */
+    gint64 session_drawn;
+    gint64 session_charged;
+
+    /* Derived from the learned profile, so a time can be looked up directly */
+    int to_empty[PROFILE_STEPS + 1];    /* Seconds from n% to empty, -1 if nothing learned */
+    int to_full[PROFILE_STEPS + 1];     /* Seconds from n% to full, -1 if nothing learned */
+
+    /* Derived from the current pack */
+    gint64 design;                  /* Design capacity */
+    gint64 full;                    /* Last full capacity, persisted so it is only counted once */
+    int wear;                       /* Percentage of design capacity lost, -1 if unknown */
+
+    /* State carried between samples */
+    int level;                      /* Percentage at last sample, -1 if unknown */
+    status_t step_status;           /* Direction of the step being timed */
+    int step_level;                 /* Percentage being timed, -1 if none */
+    gint64 step_time;               /* Time that percentage was reached, -1 if part way through */
+    status_t energy_status;         /* State at the last power reading */
+    gint64 energy_power;            /* Last power reading in uW, -1 if none */
+    gint64 energy_time;             /* Time of the last power reading, -1 after a gap */
+    gint64 save_time;               /* Time of the last periodic save, -1 before the first sample */
+} BattStats;
+
+/*----------------------------------------------------------------------------*/
+/* Prototypes                                                                 */
+/*----------------------------------------------------------------------------*/
+
+extern void batt_stats_init (BattStats *s, const char *id);
+extern void batt_stats_update (BattStats *s, const BattSnapshot *snap);
+extern int batt_stats_estimate (BattStats *s, const BattSnapshot *snap);
+extern void batt_stats_resume (BattStats *s);
+extern void batt_stats_save (BattStats *s);
+extern void batt_stats_free (BattStats *s);
+
+#endif
+
+/* End of file */
+/*----------------------------------------------------------------------------*/
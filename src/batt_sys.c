@@ -32,15 +32,59 @@
 #endif
 
 #include "batt_sys.h"
+#include "batt_trace.h"
 #include <glib/gstdio.h>
 
 /* shrug: get rid of this */
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#ifdef HAVE_IO_URING
+#include <liburing.h>
+#endif
+
+/* battery_fetch() keeps one slot per attribute, the uevent file being last
+ * and larger than the rest */
+#define CACHE_SIZE (BATT_ATTR_UEVENT * ATTR_SIZE + UEVENT_SIZE)
+#define CACHE_SLOT(b, attr) ((b)->cache + (attr) * ATTR_SIZE)
+#define CACHE_SLOT_SIZE(attr) ((attr) == BATT_ATTR_UEVENT ? UEVENT_SIZE : ATTR_SIZE)
+
+#ifdef HAVE_IO_URING
+/* Reads queued at once - a larger pass is submitted in several batches */
+#define FETCH_DEPTH 32
+
+static struct io_uring ring;
+static int ring_ready;      /* 1 once set up, -1 if io_uring is unavailable */
+#endif
+
+static const char *attr_names[BATT_ATTR_COUNT] = {
+    "charge_now",
+    "energy_now",
+    "current_now",
+    "power_now",
+    "voltage_now",
+    "charge_full",
+    "energy_full",
+    "charge_full_design",
+    "energy_full_design",
+    "capacity",
+    "status",
+    "state",
+    "type",
+    "scope",
+    "model_name",
+    "serial_number",
+    "uevent"
+};
 
 battery* battery_new() {
     static int battery_num = 1;
     battery * b = g_new0 ( battery, 1 );
+    int i;
     b->type_battery = TRUE;
     //b->capacity_unit = "mAh";
     b->energy_full = -1;
@@ -52,7 +96,10 @@ battery* battery_new() {
     b->charge_now = -1;
     b->current_now = -1;
     b->power_now = -1;
-    b->state = NULL;
+    b->capacity = -1;
+    b->dirfd = -1;
+    for (i = 0; i < BATT_ATTR_COUNT; i++)
+        b->fd[i] = -1;
     b->battery_num = battery_num;
     b->seconds = -1;
     b->percentage = -1;
@@ -62,41 +109,134 @@ battery* battery_new() {
 }
 
 
-static gchar* parse_info_file(battery *b, char *sys_file)
+/* battery_close():
+ *         Close the descriptors opened by battery_probe(). */
+static void battery_close(battery *b)
 {
-    char *buf = NULL;
-    GString *filename = g_string_new(ACPI_PATH_SYS_POWER_SUPPLY);
+    int i;
 
-    g_string_append_printf (filename, "/%s/%s", b->path, sys_file);
+    for (i = 0; i < BATT_ATTR_COUNT; i++) {
+        if (b->fd[i] >= 0)
+            close(b->fd[i]);
+        b->fd[i] = -1;
+    }
+    if (b->dirfd >= 0)
+        close(b->dirfd);
+    b->dirfd = -1;
+    b->caps = 0;
+}
 
-    if (g_file_get_contents(filename->str, &buf, NULL, NULL) == TRUE) {
-        g_strstrip( buf );
+/* read_raw():
+ *         Read an attribute's contents into the supplied buffer, taking them
+ *         from the values read ahead by battery_fetch() where there are any,
+ *         and otherwise through the descriptor opened by battery_probe().
+ *         sysfs regenerates the contents on every read from offset 0, so
+ *         nothing is reopened. Returns the length read, or -1. The
+ *         descriptors outlive the device, but reads from them then fail with
+ *         ENODEV, which marks the battery as removed. */
+static ssize_t read_raw(battery *b, int attr, char *buf, size_t len)
+{
+    ssize_t n;
+
+    if (b->fetched & (1u << attr)) {
+        b->fetched &= ~(1u << attr);
+        n = b->cache_len[attr];
+        if (n == -ENODEV)
+            b->removed = TRUE;
+        if (n < 0)
+            return -1;
+        n = MIN(n, (ssize_t) len - 1);
+        memcpy(buf, CACHE_SLOT(b, attr), n);
+        return n;
     }
 
-    g_string_free(filename, TRUE);
+    BATT_TRACE_START(read, b->path, attr_names[attr]);
+    n = pread(b->fd[attr], buf, len - 1, 0);
+    BATT_TRACE_END(read, b->path, attr_names[attr]);
+    if (n < 0 && errno == ENODEV)
+        b->removed = TRUE;
+    return n;
+}
 
-    return buf;
+/* read_attr():
+ *         Read an attribute into the supplied buffer, stripped of whitespace.
+ *         Attributes the driver does not export fail at once. */
+static gboolean read_attr(battery *b, int attr, char *buf, size_t len)
+{
+    ssize_t n;
+
+    if (!BATT_HAS(b, attr))
+        return FALSE;
+
+    n = read_raw(b, attr, buf, len);
+    if (n <= 0)
+        return FALSE;
+    buf[n] = 0;
+    g_strstrip(buf);
+
+    return TRUE;
 }
 
-/* get_gint_from_infofile():
- *         If the sys_file exists, then its value is converted to an int,
- *         divided by 1000, and returned.
+/* get_gint64_attr():
+ *         If the attribute can be read, then its value is converted to a
+ *         64-bit integer, in the driver's own micro-units, and returned.
  *         Failure is indicated by returning -1. */
-static gint get_gint_from_infofile(battery *b, gchar *sys_file)
+static gint64 get_gint64_attr(battery *b, int attr)
+{
+    char buf[ATTR_SIZE];
+
+    if (!read_attr(b, attr, buf, sizeof(buf)))
+        return -1;
+    return g_ascii_strtoll(buf, NULL, 10);
+}
+
+/* fix_rate():
+ *         Some battery drivers report -1000 when the rate is unavailable.
+ *         Others use negative values when discharging. Treat -1000 as an
+ *         error, and take the absolute value otherwise. */
+static gint64 fix_rate(gint64 rate)
 {
-    gchar *file_content = parse_info_file(b, sys_file);
-    gint value = -1;
+    if (rate == -1000)
+        return -1;
+    if (rate == G_MININT64)
+        return G_MAXINT64;
+    return rate < -1 ? -rate : rate;
+}
 
-    if (file_content != NULL)
-        value = atoi(file_content) / 1000;
-    g_free(file_content);
+/* time_to():
+ *         Seconds to move the given amount at the given rate, in the same
+ *         micro-units per hour, or -1 if there is no rate. Times too long
+ *         for an int are clamped, and the scaling is ordered so that it
+ *         cannot overflow, whatever the driver reports. */
+static int time_to(gint64 amount, gint64 rate)
+{
+    if (rate <= 0 || amount < 0)
+        return -1;
+    if (amount / rate >= G_MAXINT / 3600)
+        return G_MAXINT;
+    if (amount <= G_MAXINT64 / 3600)
+        return 3600 * amount / rate;
+    return amount / rate * 3600;
+}
 
-    return value;
+/* per_mille():
+ *         The level as thousandths of the full capacity, without overflow
+ *         whatever the driver reports. */
+static gint64 per_mille(gint64 now, gint64 full)
+{
+    now = MIN(now, full);
+    if (full <= G_MAXINT64 / 1000)
+        return now * 1000 / full;
+    return now / (full / 1000);
 }
 
-static gchar* get_gchar_from_infofile(battery *b, gchar *sys_file)
+static gchar* get_gchar_attr(battery *b, int attr)
 {
-    return parse_info_file(b, sys_file);
+    char buf[BUF_SIZE];
+
+    if (!read_attr(b, attr, buf, sizeof(buf)))
+        return NULL;
+    return g_strdup(buf);
 }
 
 #if 0 /* never used */
@@ -146,74 +286,336 @@ void battery_print(battery *b, int show_capacity)
 }
 #endif
 
-static gboolean battery_inserted(gchar* path)
+
+/* battery_probe():
+ *         Record which attributes the driver exports, so that missing ones
+ *         are not tried on every update. Also reads the type and scope,
+ *         which do not change while the supply is present. */
+static void battery_probe(battery *b)
 {
-    if (path == NULL)
+    gchar *gctmp;
+    gchar *dirname;
+    int i;
+
+    battery_close(b);
+
+    dirname = g_build_filename(ACPI_PATH_SYS_POWER_SUPPLY, b->path, NULL);
+    b->dirfd = open(dirname, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    g_free(dirname);
+
+    b->caps = 0;
+    for (i = 0; i < BATT_ATTR_COUNT && b->dirfd >= 0; i++) {
+        b->fd[i] = openat(b->dirfd, attr_names[i], O_RDONLY | O_CLOEXEC);
+        if (b->fd[i] >= 0)
+            b->caps |= 1u << i;
+    }
+
+    gctmp = get_gchar_attr(b, BATT_ATTR_TYPE);
+    b->type_battery = gctmp ? (strcasecmp(gctmp, "battery") == 0) : TRUE;
+    g_free(gctmp);
+
+    g_free(b->scope);
+    b->scope = get_gchar_attr(b, BATT_ATTR_SCOPE);
+}
+
+
+/* fetch_mask():
+ *         The attributes read by the next battery_update(), or by
+ *         battery_update_uevent() if uevent is set. Peripherals, with only
+ *         their uevent file open, are always read through it, so they can
+ *         share a pass with a battery read attribute by attribute. */
+static guint fetch_mask(battery *b, gboolean uevent)
+{
+    guint mask;
+
+    if (uevent || b->caps == (1u << BATT_ATTR_UEVENT))
+        return b->caps & (1u << BATT_ATTR_UEVENT);
+
+    mask = (1u << BATT_ATTR_CURRENT_NOW) | (1u << BATT_ATTR_POWER_NOW)
+        | (1u << BATT_ATTR_VOLTAGE_NOW) | (1u << BATT_ATTR_CAPACITY)
+        | (1u << BATT_ATTR_STATUS) | (1u << BATT_ATTR_STATE)
+        | (1u << BATT_ATTR_CHARGE_FULL) | (1u << BATT_ATTR_ENERGY_FULL);
+    /* see battery_update() */
+    if (!BATT_HAS(b, BATT_ATTR_CAPACITY)
+            || BATT_HAS(b, BATT_ATTR_CURRENT_NOW) || BATT_HAS(b, BATT_ATTR_POWER_NOW))
+        mask |= (1u << BATT_ATTR_CHARGE_NOW) | (1u << BATT_ATTR_ENERGY_NOW);
+    return b->caps & mask;
+}
+
+#ifdef HAVE_IO_URING
+/* fetch_reap():
+ *         Submit the queued reads and wait for all of them to complete,
+ *         recording the length read by each. A signal arriving while
+ *         waiting only restarts the wait, as a completion left behind would
+ *         be written through later into a battery which may have been freed.
+ *         If the completions cannot all be accounted for, the ring is
+ *         closed and FALSE returned, so the reads must be made directly. */
+static gboolean fetch_reap(int queued)
+{
+    struct io_uring_cqe *cqe;
+    int ret;
+
+    if (queued == 0)
+        return TRUE;
+
+    BATT_TRACE_START(read, "batch", "uring");
+    do
+        ret = io_uring_submit_and_wait(&ring, queued);
+    while (ret == -EINTR);
+    while (ret >= 0 && queued > 0) {
+        ret = io_uring_wait_cqe(&ring, &cqe);
+        if (ret == -EINTR)
+            continue;
+        if (ret < 0)
+            break;
+        *(int *) io_uring_cqe_get_data(cqe) = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+        queued--;
+    }
+    BATT_TRACE_END(read, "batch", "uring");
+
+    if (queued == 0)
+        return TRUE;
+    io_uring_queue_exit(&ring);
+    ring_ready = -1;
+    return FALSE;
+}
+
+/* fetch_uring():
+ *         battery_fetch() through io_uring - every read is queued, then
+ *         submitted and reaped with a single system call. Returns FALSE if
+ *         io_uring is not available, so the reads must be made directly. */
+static gboolean fetch_uring(GList *batteries, gboolean uevent)
+{
+    struct io_uring_sqe *sqe;
+    battery *b;
+    guint mask;
+    int i, queued = 0;
+    GList *l;
+
+    if (ring_ready == 0)
+        ring_ready = io_uring_queue_init(FETCH_DEPTH, &ring, 0) == 0 ? 1 : -1;
+    if (ring_ready < 0)
         return FALSE;
 
-    GString *dirname = g_string_new(ACPI_PATH_SYS_POWER_SUPPLY);
-    GDir *dir;
+    for (l = batteries; l; l = l->next) {
+        b = (battery *) l->data;
+        mask = fetch_mask(b, uevent);
+        for (i = 0; i < BATT_ATTR_COUNT; i++) {
+            if (!(mask & (1u << i)))
+                continue;
+            if ((sqe = io_uring_get_sqe(&ring)) == NULL) {
+                if (!fetch_reap(queued))
+                    return FALSE;
+                queued = 0;
+                sqe = io_uring_get_sqe(&ring);
+            }
+            io_uring_prep_read(sqe, b->fd[i], CACHE_SLOT(b, i), CACHE_SLOT_SIZE(i) - 1, 0);
+            io_uring_sqe_set_data(sqe, &b->cache_len[i]);
+            b->cache_len[i] = -1;
+            b->fetched |= 1u << i;
+            queued++;
+        }
+    }
+    return fetch_reap(queued);
+}
+#endif
 
-    g_string_append_printf (dirname, "/%s/", path);
-    dir = g_dir_open(dirname->str, 0, NULL);
-    if (dir)
-        g_dir_close(dir);
-    g_string_free(dirname, TRUE);
+/* battery_fetch():
+ *         Read everything the next update of each battery in the list needs
+ *         in one pass, so battery_update() - or battery_update_uevent() if
+ *         uevent is set - takes its values from memory. With io_uring the
+ *         reads go to the kernel as one batch, so a pass costs the same
+ *         number of system calls however many batteries and attributes
+ *         there are; otherwise they are made one at a time. */
+void battery_fetch(GList *batteries, gboolean uevent)
+{
+    battery *b;
+    guint mask;
+    int i;
+    GList *l;
+
+    for (l = batteries; l; l = l->next) {
+        b = (battery *) l->data;
+        b->fetched = 0;
+        if (b->cache == NULL)
+            b->cache = g_malloc(CACHE_SIZE);
+    }
+
+#ifdef HAVE_IO_URING
+    if (fetch_uring(batteries, uevent))
+        return;
+#endif
 
-    return dir ? TRUE : FALSE;
+    for (l = batteries; l; l = l->next) {
+        b = (battery *) l->data;
+        mask = fetch_mask(b, uevent);
+        for (i = 0; i < BATT_ATTR_COUNT; i++) {
+            if (!(mask & (1u << i)))
+                continue;
+            BATT_TRACE_START(read, b->path, attr_names[i]);
+            b->cache_len[i] = pread(b->fd[i], CACHE_SLOT(b, i), CACHE_SLOT_SIZE(i) - 1, 0);
+            if (b->cache_len[i] < 0)
+                b->cache_len[i] = -errno;
+            BATT_TRACE_END(read, b->path, attr_names[i]);
+            b->fetched |= 1u << i;
+        }
+    }
+}
+
+/* battery_fetch_close():
+ *         Release what battery_fetch() keeps between passes - the io_uring
+ *         ring, which is set up again by the next pass if there is one. */
+void battery_fetch_close(void)
+{
+#ifdef HAVE_IO_URING
+    if (ring_ready > 0)
+        io_uring_queue_exit(&ring);
+    ring_ready = 0;
+#endif
 }
 
+static void battery_set_state(battery *b, const char *status);
+static void battery_compute(battery *b);
 
 battery* battery_update(battery *b)
 {
-    gchar *gctmp;
-    int promille;
+    char buf[sizeof(b->state)];
+    GList self = { b, NULL, NULL };
 
-    if (b == NULL)
+    if (b == NULL || b->removed)
         return NULL;
 
-    if (!battery_inserted(b->path))
-        return NULL;
+    /* read everything at once, unless the caller already has */
+    if (!b->fetched)
+        battery_fetch(&self, FALSE);
 
-    /* read from sysfs */
-    b->charge_now = get_gint_from_infofile(b, "charge_now");
-    b->energy_now = get_gint_from_infofile(b, "energy_now");
+    /* read from sysfs - if the driver reports the percentage itself, the
+     * charge and energy levels are only needed for the time estimate */
+    if (!BATT_HAS(b, BATT_ATTR_CAPACITY)
+            || BATT_HAS(b, BATT_ATTR_CURRENT_NOW) || BATT_HAS(b, BATT_ATTR_POWER_NOW)) {
+        b->charge_now = get_gint64_attr(b, BATT_ATTR_CHARGE_NOW);
+        b->energy_now = get_gint64_attr(b, BATT_ATTR_ENERGY_NOW);
+    }
 
-    b->current_now = get_gint_from_infofile(b, "current_now");
-    b->power_now   = get_gint_from_infofile(b, "power_now");
-    /* FIXME: Some battery drivers report -1000 when the discharge rate is
-     * unavailable. Others use negative values when discharging. Best we can do
-     * is to treat -1 as an error, and take the absolute value otherwise.
-     * Ideally the kernel would not export the sysfs file when the value is not
-     * available. */
-    if (b->current_now < -1)
-            b->current_now = - b->current_now;
+    /* FIXME: Ideally the kernel would not export the sysfs file when the
+     * value is not available - see fix_rate() */
+    b->current_now = fix_rate(get_gint64_attr(b, BATT_ATTR_CURRENT_NOW));
+    b->power_now   = get_gint64_attr(b, BATT_ATTR_POWER_NOW);
 
-    b->charge_full = get_gint_from_infofile(b, "charge_full");
-    b->energy_full = get_gint_from_infofile(b, "energy_full");
+    b->voltage_now = get_gint64_attr(b, BATT_ATTR_VOLTAGE_NOW);
 
-    b->charge_full_design = get_gint_from_infofile(b, "charge_full_design");
-    b->energy_full_design = get_gint_from_infofile(b, "energy_full_design");
+    if (!read_attr(b, BATT_ATTR_STATUS, buf, sizeof(buf))
+            && !read_attr(b, BATT_ATTR_STATE, buf, sizeof(buf)))
+        *buf = 0;
 
-    b->voltage_now = get_gint_from_infofile(b, "voltage_now");
+    /* Fuel gauges may revise the full capacity at any time, so unlike the
+     * design capacity it is read on every update */
+    b->charge_full = get_gint64_attr(b, BATT_ATTR_CHARGE_FULL);
+    b->energy_full = get_gint64_attr(b, BATT_ATTR_ENERGY_FULL);
 
-    gctmp = get_gchar_from_infofile(b, "type");
-    b->type_battery = gctmp ? (strcasecmp(gctmp, "battery") == 0) : TRUE;
-    g_free(gctmp);
+    battery_set_state(b, buf);
+
+    if (!BATT_HAS(b, BATT_ATTR_CAPACITY) || !read_attr(b, BATT_ATTR_CAPACITY, buf, sizeof(buf)))
+        b->capacity = -1;
+    else
+        b->capacity = atoi(buf);
+    b->fetched = 0;
+
+    if (b->removed)
+        return NULL;
 
-    g_free(b->state);
-    b->state = get_gchar_from_infofile(b, "status");
-    if (!b->state)
-        b->state = get_gchar_from_infofile(b, "state");
-    if (!b->state) {
-        if (b->charge_now != -1 || b->energy_now != -1
-                || b->charge_full != -1 || b->energy_full != -1)
-            b->state = g_strdup("available");
-        else
-            b->state = g_strdup("unavailable");
+    BATT_TRACE_START(parse, b->path);
+    battery_compute(b);
+    BATT_TRACE_END(parse, b->path);
+    return b;
+}
+
+
+/* battery_update_uevent():
+ *         As battery_update(), but takes every value from a single read of
+ *         the supply's uevent file rather than one read per attribute. */
+battery* battery_update_uevent(battery *b)
+{
+    char buf[UEVENT_SIZE];
+    char status[sizeof(b->state)];
+    char *line, *next, *val;
+    ssize_t n;
+    int i;
+
+    if (b == NULL || b->removed || !BATT_HAS(b, BATT_ATTR_UEVENT))
+        return NULL;
+
+    n = read_raw(b, BATT_ATTR_UEVENT, buf, sizeof(buf));
+    b->fetched = 0;
+    if (n <= 0)
+        return NULL;
+    buf[n] = 0;
+
+    BATT_TRACE_START(parse, b->path);
+
+    b->charge_now = b->energy_now = b->current_now = b->power_now = -1;
+    b->voltage_now = b->charge_full = b->energy_full = b->capacity = -1;
+    *status = 0;
+
+    /* each line is POWER_SUPPLY_<ATTRIBUTE>=<value> */
+    for (line = buf; line && *line; line = next) {
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = 0;
+        if (strncmp(line, "POWER_SUPPLY_", 13) != 0 || (val = strchr(line, '=')) == NULL)
+            continue;
+        *val++ = 0;
+        line += 13;
+
+        for (i = 0; i < BATT_ATTR_COUNT; i++)
+            if (g_ascii_strcasecmp(line, attr_names[i]) == 0)
+                break;
+
+        switch (i) {
+            case BATT_ATTR_CHARGE_NOW:  b->charge_now = g_ascii_strtoll(val, NULL, 10); break;
+            case BATT_ATTR_ENERGY_NOW:  b->energy_now = g_ascii_strtoll(val, NULL, 10); break;
+            case BATT_ATTR_CURRENT_NOW: b->current_now = g_ascii_strtoll(val, NULL, 10); break;
+            case BATT_ATTR_POWER_NOW:   b->power_now = g_ascii_strtoll(val, NULL, 10); break;
+            case BATT_ATTR_VOLTAGE_NOW: b->voltage_now = g_ascii_strtoll(val, NULL, 10); break;
+            case BATT_ATTR_CHARGE_FULL: b->charge_full = g_ascii_strtoll(val, NULL, 10); break;
+            case BATT_ATTR_ENERGY_FULL: b->energy_full = g_ascii_strtoll(val, NULL, 10); break;
+            case BATT_ATTR_CAPACITY:    b->capacity = atoi(val); break;
+            case BATT_ATTR_STATUS:
+                g_strlcpy(status, val, sizeof(status));
+                break;
+        }
     }
-    g_free(b->scope);
-    b->scope = get_gchar_from_infofile(b, "scope");
+
+    b->current_now = fix_rate(b->current_now);
+
+    battery_set_state(b, status);
+    battery_compute(b);
+    BATT_TRACE_END(parse, b->path);
+    return b;
+}
+
+
+/* battery_set_state():
+ *         Record the status read from the driver, or make one up from
+ *         whether any levels could be read. */
+static void battery_set_state(battery *b, const char *status)
+{
+    if (*status)
+        g_strlcpy(b->state, status, sizeof(b->state));
+    else if (b->charge_now != -1 || b->energy_now != -1
+            || b->charge_full != -1 || b->energy_full != -1)
+        strcpy(b->state, "available");
+    else
+        strcpy(b->state, "unavailable");
+}
+
+
+/* battery_compute():
+ *         Derive the percentage and time remaining from the values read. */
+static void battery_compute(battery *b)
+{
+    gint64 promille;
 
 #if 0 /* those conversions might be good for text prints but are pretty wrong for tooltip and calculations */
     /* convert energy values (in mWh) to charge values (in mAh) if needed and possible */
@@ -256,11 +658,13 @@ battery* battery_update(battery *b)
     }
 #endif
 
-    if (b->charge_now != -1 && b->charge_full != -1)
-        promille = (b->charge_now * 1000) / b->charge_full;
-    else if (b->energy_full != -1 && b->energy_now != -1)
+    if (b->capacity >= 0)
+        promille = b->capacity * 10;
+    else if (b->charge_now >= 0 && b->charge_full > 0)
+        promille = per_mille(b->charge_now, b->charge_full);
+    else if (b->energy_full > 0 && b->energy_now >= 0)
         /* no charge data, let try energy instead */
-        promille = (b->energy_now * 1000) / b->energy_full;
+        promille = per_mille(b->energy_now, b->energy_full);
     else
         promille = 0;
 
@@ -269,26 +673,26 @@ battery* battery_update(battery *b)
         b->percentage = 100;
 
     if (b->power_now < -1)
-        b->power_now = - b->power_now;
+        b->power_now = b->power_now == G_MININT64 ? G_MAXINT64 : - b->power_now;
     if (b->current_now == -1 && b->power_now == -1) {
         //b->poststr = "rate information unavailable";
         b->seconds = -1;
     } else if (!strcasecmp(b->state, "charging")) {
-        if (b->current_now > MIN_PRESENT_RATE) {
-            b->seconds = 3600 * (b->charge_full - b->charge_now) / b->current_now;
+        if (b->current_now >= MIN_PRESENT_RATE) {
+            b->seconds = time_to(b->charge_full - b->charge_now, b->current_now);
             //b->poststr = " until charged";
-        } else if (b->power_now > 0) {
-            b->seconds = 3600 * (b->energy_full - b->energy_now) / b->power_now;
+        } else if (b->power_now >= MIN_PRESENT_RATE) {
+            b->seconds = time_to(b->energy_full - b->energy_now, b->power_now);
         } else {
             //b->poststr = "charging at zero rate - will never fully charge.";
             b->seconds = -1;
         }
     } else if (!strcasecmp(b->state, "discharging")) {
-        if (b->current_now > MIN_PRESENT_RATE) {
-            b->seconds = 3600 * b->charge_now / b->current_now;
+        if (b->current_now >= MIN_PRESENT_RATE) {
+            b->seconds = time_to(b->charge_now, b->current_now);
             //b->poststr = " remaining";
-        } else if (b->power_now > 0) {
-            b->seconds = 3600 * b->energy_now / b->power_now;
+        } else if (b->power_now >= MIN_PRESENT_RATE) {
+            b->seconds = time_to(b->energy_now, b->power_now);
         } else {
             //b->poststr = "discharging at zero rate - will never fully discharge.";
             b->seconds = -1;
@@ -297,8 +701,30 @@ battery* battery_update(battery *b)
         //b->poststr = NULL;
         b->seconds = -1;
     }
+}
 
-    return b;
+
+/* battery_read_static():
+ *         Read the attributes which only change when the pack is swapped -
+ *         the design capacities and the identity used to key stored data. */
+static void battery_read_static(battery *b)
+{
+    gchar *model, *serial;
+
+    b->charge_full_design = get_gint64_attr(b, BATT_ATTR_CHARGE_FULL_DESIGN);
+    b->energy_full_design = get_gint64_attr(b, BATT_ATTR_ENERGY_FULL_DESIGN);
+
+    model = get_gchar_attr(b, BATT_ATTR_MODEL_NAME);
+    serial = get_gchar_attr(b, BATT_ATTR_SERIAL_NUMBER);
+    g_free(b->id);
+    if ((model && *model) || (serial && *serial))
+        b->id = g_strdup_printf("%s-%s", model ? model : "", serial ? serial : "");
+    else
+        b->id = g_strdup(b->path);
+    g_strcanon(b->id, G_CSET_a_2_z G_CSET_A_2_Z G_CSET_DIGITS "-_.", '_');
+    g_free(b->model);
+    b->model = model;
+    g_free(serial);
 }
 
 
@@ -316,6 +742,7 @@ battery *battery_get(int battery_number) {
     if (g_file_test(batt_path, G_FILE_TEST_IS_DIR) == TRUE) {
         b = battery_new();
         b->path = g_strdup( batt_name);
+        battery_probe ( b );
         battery_update ( b );
 
         if (!b->type_battery) {
@@ -328,8 +755,10 @@ battery *battery_get(int battery_number) {
     g_free(batt_name);
     g_free(batt_path);
 
-    if (b != NULL)
+    if (b != NULL) {
+        battery_read_static(b);
         return b;
+    }
 
     /*
      * We didn't find the expected path in sysfs.
@@ -347,6 +776,7 @@ battery *battery_get(int battery_number) {
     {
         b = battery_new();
         b->path = g_strdup( entry );
+        battery_probe ( b );
         battery_update ( b );
 
         /* We're looking for a battery with the selected ID */
@@ -356,34 +786,180 @@ battery *battery_get(int battery_number) {
         battery_free(b);
         b = NULL;
     }
-    if (b != NULL)
+    if (b != NULL) {
         g_message( "batt: battery entry " ACPI_BATTERY_DEVICE_NAME "%d not found, using %s",
             battery_number, b->path);
         // FIXME: update config?
-    else
+        battery_read_static(b);
+    } else
         g_message( "batt: battery %d not found", battery_number );
 
     g_dir_close( dir );
     return b;
 }
 
+/* battery_get_devices():
+ *         Find the batteries in peripherals (scope "Device") such as mice,
+ *         keyboards and game controllers. Only their uevent files are kept
+ *         open, as they are refreshed with battery_update_uevent(). */
+GList *battery_get_devices(void)
+{
+    const gchar *entry;
+    GList *devices = NULL;
+    GDir *dir;
+    battery *b;
+    int i;
+
+    dir = g_dir_open( ACPI_PATH_SYS_POWER_SUPPLY, 0, NULL );
+    if ( dir == NULL )
+        return NULL;
+
+    while ( ( entry = g_dir_read_name (dir) ) != NULL )
+    {
+        b = battery_new();
+        b->path = g_strdup( entry );
+        battery_probe( b );
+
+        if (!b->type_battery || g_strcmp0 (b->scope, "Device") || !BATT_HAS(b, BATT_ATTR_UEVENT)) {
+            battery_free(b);
+            continue;
+        }
+
+        battery_read_static( b );
+        for (i = 0; i < BATT_ATTR_COUNT; i++) {
+            if (i != BATT_ATTR_UEVENT && b->fd[i] >= 0) {
+                close(b->fd[i]);
+                b->fd[i] = -1;
+            }
+        }
+        b->caps = 1u << BATT_ATTR_UEVENT;
+        battery_update_uevent( b );
+        devices = g_list_append(devices, b);
+    }
+
+    g_dir_close( dir );
+    return devices;
+}
+
+/* battery_rebind():
+ *         Bind a removed battery to the newly added supply of the given name,
+ *         if it is the same supply, or the same pack by model and serial
+ *         number under another name. The battery keeps its address, so
+ *         whoever holds it sees the new supply from the next update. */
+gboolean battery_rebind(battery *b, const char *name)
+{
+    battery *c;
+    gboolean match;
+
+    if (!b->removed)
+        return FALSE;
+
+    c = battery_new();
+    c->path = g_strdup(name);
+    battery_probe(c);
+    match = c->caps && c->type_battery && g_strcmp0(c->scope, "Device");
+    if (match) {
+        battery_read_static(c);
+        match = !strcmp(c->path, b->path) || !g_strcmp0(c->id, b->id);
+    }
+    if (!match) {
+        battery_free(c);
+        return FALSE;
+    }
+
+    battery_close(b);
+    g_free(b->path);
+    g_free(b->id);
+    g_free(b->model);
+    g_free(b->scope);
+    g_free(b->cache);
+    c->battery_num = b->battery_num;
+    *b = *c;
+    g_free(c);
+
+    battery_update(b);
+    return TRUE;
+}
+
 void battery_free(battery* bat)
 {
     if (bat) {
+        battery_close(bat);
         g_free(bat->path);
-        g_free(bat->state);
+        g_free(bat->id);
+        g_free(bat->model);
+        g_free(bat->scope);
+        g_free(bat->cache);
         g_free(bat);
     }
 }
 
+/* battery_monitor_open():
+ *         Open a socket which receives the kernel's uevents, so that power
+ *         supply changes can be handled as they happen.
+ *         Failure is indicated by returning -1. */
+int battery_monitor_open(void)
+{
+    struct sockaddr_nl addr;
+    int fd;
+
+    fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1; /* events from the kernel, rather than udev */
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* battery_monitor_read():
+ *         Read one uevent from the socket. If it is for a power supply, the
+ *         supply name is copied to name and the action returned, otherwise
+ *         BATT_EVENT_NONE is returned. Returns -1 once nothing is pending. */
+int battery_monitor_read(int fd, char *name, size_t len)
+{
+    char buf[UEVENT_SIZE];
+    char *devpath, *supply;
+    ssize_t n;
+
+    *name = 0;
+    n = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+    if (n <= 0)
+        return -1;
+    buf[n] = 0;
+
+    /* the message starts with <action>@<devpath> */
+    devpath = strchr(buf, '@');
+    if (devpath == NULL)
+        return BATT_EVENT_NONE;
+    *devpath++ = 0;
+    supply = strstr(devpath, "/power_supply/");
+    if (supply == NULL)
+        return BATT_EVENT_NONE;
+    g_strlcpy(name, supply + 14, len);
+
+    if (!strcmp(buf, "change"))
+        return BATT_EVENT_CHANGE;
+    if (!strcmp(buf, "add"))
+        return BATT_EVENT_ADD;
+    if (!strcmp(buf, "remove"))
+        return BATT_EVENT_REMOVE;
+    return BATT_EVENT_NONE;
+}
+
 gboolean battery_is_charging( battery *b )
 {
-    if (!b->state)
+    if (!*b->state)
         return TRUE; // Same as "Unkown"
     return ( strcasecmp( b->state, "Unknown" ) == 0
             || strcasecmp( b->state, "Full" ) == 0
             || strcasecmp( b->state, "Charging" ) == 0
-            || b->current_now == 0 ); /* bug sf.net, #720 */
+            || ( b->current_now >= 0 && b->current_now < MIN_PRESENT_RATE ) ); /* bug sf.net, #720 */
 }
 
 gint battery_get_remaining( battery *b )
@@ -26,32 +26,86 @@
 
 
 #define BUF_SIZE 1024
+#define ATTR_SIZE 32
+#define UEVENT_SIZE 4096
+#ifndef ACPI_PATH_SYS_POWER_SUPPLY  /* the read benchmark uses a tree of its own */
 #define ACPI_PATH_SYS_POWER_SUPPLY  "/sys/class/power_supply"
+#endif
 #define ACPI_BATTERY_DEVICE_NAME    "BAT"
 #define MIN_CAPACITY	 0.01
-#define MIN_PRESENT_RATE 0.01
+/* Rates below this, in uA or uW, count as none - the 1 mA or 1 mW that the
+ * old milli-unit readings needed to show anything */
+#define MIN_PRESENT_RATE 1000
 #define BATTERY_DESC	"Battery"
 
 #include <glib.h>
 
+/* Attributes which a power supply driver may export */
+enum {
+    BATT_ATTR_CHARGE_NOW,
+    BATT_ATTR_ENERGY_NOW,
+    BATT_ATTR_CURRENT_NOW,
+    BATT_ATTR_POWER_NOW,
+    BATT_ATTR_VOLTAGE_NOW,
+    BATT_ATTR_CHARGE_FULL,
+    BATT_ATTR_ENERGY_FULL,
+    BATT_ATTR_CHARGE_FULL_DESIGN,
+    BATT_ATTR_ENERGY_FULL_DESIGN,
+    BATT_ATTR_CAPACITY,
+    BATT_ATTR_STATUS,
+    BATT_ATTR_STATE,
+    BATT_ATTR_TYPE,
+    BATT_ATTR_SCOPE,
+    BATT_ATTR_MODEL_NAME,
+    BATT_ATTR_SERIAL_NUMBER,
+    BATT_ATTR_UEVENT,
+    BATT_ATTR_COUNT
+};
+
+/* Power supply events from battery_monitor_read() */
+enum {
+    BATT_EVENT_NONE,
+    BATT_EVENT_CHANGE,
+    BATT_EVENT_ADD,
+    BATT_EVENT_REMOVE
+};
+
+#define BATT_HAS(b, attr) (((b)->caps & (1u << (attr))) != 0)
+
 typedef struct battery {
     int battery_num;
     /* path to battery dir */
     gchar *path;
-    /* sysfs file contents */
-    int charge_now;
-    int energy_now;
-    int current_now;
-    int power_now;
-    int voltage_now;
-    int charge_full_design;
-    int energy_full_design;
-    int charge_full;
-    int energy_full;
+    /* persistent identity (model and serial number, or path) */
+    gchar *id;
+    gchar *model;
+    /* bitmap of BATT_ATTR_* present, probed when the battery is opened */
+    guint caps;
+    /* descriptors of the battery directory and each attribute present */
+    int dirfd;
+    int fd[BATT_ATTR_COUNT];
+    /* values read ahead by battery_fetch(), and which are still to be used */
+    char *cache;
+    int cache_len[BATT_ATTR_COUNT];
+    guint fetched;
+    /* set when a read finds the device gone */
+    gboolean removed;
+    /* sysfs file contents, in the uAh, uWh, uA, uW and uV the driver
+     * reports, so that neither resolution nor range is lost */
+    gint64 charge_now;
+    gint64 energy_now;
+    gint64 current_now;
+    gint64 power_now;
+    gint64 voltage_now;
+    gint64 charge_full_design;
+    gint64 energy_full_design;
+    gint64 charge_full;
+    gint64 energy_full;
+    int capacity;
     /* extra info */
     int seconds;
     int percentage;
-    char *state;
+    char state[ATTR_SIZE];
     char *scope;
     //const char *poststr;
     //const char *capacity_unit;
@@ -59,10 +113,17 @@ typedef struct battery {
 } battery;
 
 battery *battery_get(int);
+GList *battery_get_devices(void);
 battery *battery_update( battery *b );
+battery *battery_update_uevent( battery *b );
+void battery_fetch(GList *batteries, gboolean uevent);
+void battery_fetch_close(void);
+gboolean battery_rebind(battery *b, const char *name);
 //void battery_print(battery *b, int show_capacity);
 gboolean battery_is_charging( battery *b );
 gint battery_get_remaining( battery *b );
 void battery_free(battery* bat);
+int battery_monitor_open(void);
+int battery_monitor_read(int fd, char *name, size_t len);
 
 #endif
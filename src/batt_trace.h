@@ -0,0 +1,85 @@
+/*============================================================================
+Copyright (c) 2025 Raspberry Pi Holdings Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+============================================================================*/
+
+#ifndef BATT_TRACE_H
+#define BATT_TRACE_H
+
+/*----------------------------------------------------------------------------*/
+/* Typedefs and macros                                                        */
+/*----------------------------------------------------------------------------*/
+
+/* Static tracing probes around each stage of sampling and drawing, for perf
+ * or bpftrace, e.g.
+ *     bpftrace -e 'usdt:<plugin.so>:batt:draw_end { @[str(arg0)] = hist(arg1); }'
+ * Each stage has a <stage>_start probe taking the battery name, and a
+ * <stage>_end probe taking the same arguments followed by the duration in us.
+ * Every probe has a semaphore, so when nothing is attached the cost is one
+ * test of a flag, and the clock is not read. */
+
+#define BATT_TRACE_PROBES(X) \
+    X (timer_start) X (timer_end) \
+    X (read_start) X (read_end) \
+    X (parse_start) X (parse_end) \
+    X (draw_start) X (draw_end) \
+    X (apply_start) X (apply_end) \
+    X (frame_start) X (frame_end)
+
+#ifdef HAVE_SDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define BATT_TRACE_DECLARE(probe) extern unsigned short batt_##probe##_semaphore;
+#define BATT_TRACE_DEFINE(probe) \
+    __extension__ unsigned short batt_##probe##_semaphore __attribute__ ((unused)) __attribute__ ((section (".probes")));
+
+BATT_TRACE_PROBES (BATT_TRACE_DECLARE)
+
+#define BATT_TRACE_ENABLED(probe) __builtin_expect (batt_##probe##_semaphore, 0)
+
+#define BATT_TRACE(probe, ...) \
+    do { if (BATT_TRACE_ENABLED (probe)) STAP_PROBEV (batt, probe, __VA_ARGS__); } while (0)
+
+#define BATT_TRACE_START(stage, ...) \
+    gint64 stage##_trace = BATT_TRACE_ENABLED (stage##_end) ? g_get_monotonic_time () : 0; \
+    BATT_TRACE (stage##_start, __VA_ARGS__)
+
+#define BATT_TRACE_END(stage, ...) \
+    BATT_TRACE (stage##_end, __VA_ARGS__, g_get_monotonic_time () - stage##_trace)
+
+#else
+
+#define BATT_TRACE_DEFINE(probe)
+#define BATT_TRACE_START(stage, ...)
+#define BATT_TRACE_END(stage, ...)
+
+#endif
+
+#endif
+
+/* End of file */
+/*----------------------------------------------------------------------------*/
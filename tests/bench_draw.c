@@ -0,0 +1,238 @@
+/*============================================================================
+Copyright (c) 2025 Raspberry Pi Holdings Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+============================================================================*/
+
+/* Time the drawing code over every icon size, level and state, count the
+ * heap allocations it makes, and check every frame against the cairo drawing
+ * the plugin used before it painted pixels directly. The reference is drawn
+ * as that code drew it, on a new surface each time, so its time is given
+ * too. Only the painting is timed - the surface is rebuilt once per size, as
+ * in use. The argument is the directory holding the symbols. */
+
+#include <stdio.h>
+#include <string.h>
+#include <gdk/gdk.h>
+#include "batt_draw.h"
+#include "alloc.h"
+
+/*----------------------------------------------------------------------------*/
+/* Typedefs and macros                                                        */
+/*----------------------------------------------------------------------------*/
+
+/* Range of icon sizes drawn, and the passes over each */
+#define BENCH_MIN_SIZE 16
+#define BENCH_MAX_SIZE 128
+#define BENCH_REPEATS 10
+
+/* Levels drawn in each state */
+#define LEVELS 101
+
+/*----------------------------------------------------------------------------*/
+/* Prototypes                                                                 */
+/*----------------------------------------------------------------------------*/
+
+static cairo_surface_t *reference_icon (GdkPixbuf *plug, GdkPixbuf *flash, int w, int h, status_t status, int lev);
+
+/*----------------------------------------------------------------------------*/
+/* Function definitions                                                       */
+/*----------------------------------------------------------------------------*/
+
+/* The icon as drawn by the original cairo code, with the colours and symbols
+ * the plugin chose for each state - the caller frees the surface */
+
+static cairo_surface_t *reference_icon (GdkPixbuf *plug, GdkPixbuf *flash, int w, int h, status_t status, int lev)
+{
+    cairo_surface_t *surface;
+    cairo_t *cr;
+    float r = 0, g = 0.85, b = 0;
+    int f, powered = 0;
+
+    if (status == STAT_ABSENT)
+    {
+        r = g = b = 0.5;
+        lev = -1;
+    }
+    else if (status == STAT_CHARGING)
+    {
+        r = 0.95;
+        g = 0.64;
+        powered = 1;
+    }
+    else if (status == STAT_EXT_POWER) powered = 2;
+    else if (lev <= CRITICAL_LEVEL)
+    {
+        r = 1;
+        g = 0;
+    }
+
+    // create and clear the drawing surface
+    surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, w, h);
+    cr = cairo_create (surface);
+    cairo_set_source_rgba (cr, 0, 0, 0, 0);
+    cairo_rectangle (cr, 0, 0, w, h);
+    cairo_fill (cr);
+
+    // draw base icon on surface
+    cairo_set_source_rgb (cr, r, g, b);
+    cairo_rectangle (cr, 4, 1, w - 10, 1);
+    cairo_rectangle (cr, 3, 2, w - 8, 1);
+    cairo_rectangle (cr, 3, h - 3, w - 8, 1);
+    cairo_rectangle (cr, 4, h - 2, w - 10, 1);
+    cairo_rectangle (cr, 2, 3, 2, h - 6);
+    cairo_rectangle (cr, w - 6, 3, 2, h - 6);
+    cairo_rectangle (cr, w - 4, (h >> 1) - 3, 2, 6);
+    cairo_fill (cr);
+
+    cairo_set_source_rgba (cr, r, g, b, 0.5);
+    cairo_rectangle (cr, 3, 1, 1, 1);
+    cairo_rectangle (cr, 2, 2, 1, 1);
+    cairo_rectangle (cr, 2, h - 3, 1, 1);
+    cairo_rectangle (cr, 3, h - 2, 1, 1);
+    cairo_rectangle (cr, w - 6, 1, 1, 1);
+    cairo_rectangle (cr, w - 5, 2, 1, 1);
+    cairo_rectangle (cr, w - 5, h - 3, 1, 1);
+    cairo_rectangle (cr, w - 6, h - 2, 1, 1);
+    cairo_fill (cr);
+
+    // fill the battery
+    if (lev < 0) f = 0;
+    else if (lev > 97) f = w - 12;
+    else
+    {
+        f = (w - 12) * lev;
+        f /= 97;
+        if (f > w - 12) f = w - 12;
+    }
+    cairo_set_source_rgb (cr, r, g, b);
+    cairo_rectangle (cr, 5, 4, f, h - 8);
+    cairo_fill (cr);
+
+    // show icons
+    if (powered == 1 && flash)
+    {
+        gdk_cairo_set_source_pixbuf (cr, flash, (w >> 1) - 15, (h >> 1) - 16);
+        cairo_paint (cr);
+    }
+    if (powered == 2 && plug)
+    {
+        gdk_cairo_set_source_pixbuf (cr, plug, (w >> 1) - 16, (h >> 1) - 16);
+        cairo_paint (cr);
+    }
+
+    cairo_destroy (cr);
+    cairo_surface_flush (surface);
+    return surface;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Benchmark                                                                  */
+/*----------------------------------------------------------------------------*/
+
+int main (int argc, char *argv[])
+{
+    static const char *names[] = { "discharging", "charging", "external", "absent" };
+    BattIcon icon;
+    GdkPixbuf *plug_pb, *flash_pb;
+    cairo_surface_t *ref;
+    gchar *plug, *flash;
+    gint64 start, total = 0, ref_total = 0;
+    int ic, st, lev, rep, w, h, row, stride, frames = 0, ref_frames = 0, allocs = 0, bad = 0;
+
+    if (argc < 2)
+    {
+        fprintf (stderr, "usage: %s <image directory>\n", argv[0]);
+        return 2;
+    }
+
+    plug = g_build_filename (argv[1], "plug.png", NULL);
+    flash = g_build_filename (argv[1], "flash.png", NULL);
+    batt_icon_init (&icon, plug, flash);
+    plug_pb = gdk_pixbuf_new_from_file (plug, NULL);
+    flash_pb = gdk_pixbuf_new_from_file (flash, NULL);
+    g_free (plug);
+    g_free (flash);
+    if (!icon.plug || !icon.flash || !plug_pb || !flash_pb)
+    {
+        fprintf (stderr, "symbols not found in %s\n", argv[1]);
+        return 2;
+    }
+
+    for (ic = BENCH_MIN_SIZE; ic <= BENCH_MAX_SIZE; ic++)
+    {
+        batt_icon_dims (ic, &w, &h);
+        if (!batt_icon_paint (&icon, w, h, STAT_DISCHARGING, 0)) continue;
+        stride = cairo_image_surface_get_stride (icon.surface);
+
+        for (st = STAT_DISCHARGING; st <= STAT_ABSENT; st++)
+        {
+            // time the painting alone
+            alloc_count = 0;
+            alloc_counting = 1;
+            start = g_get_monotonic_time ();
+            for (rep = 0; rep < BENCH_REPEATS; rep++)
+                for (lev = 0; lev < LEVELS; lev++) batt_icon_paint (&icon, w, h, st, lev);
+            total += g_get_monotonic_time () - start;
+            alloc_counting = 0;
+            allocs += alloc_count;
+            frames += BENCH_REPEATS * LEVELS;
+
+            // then check each level against the reference, and time that
+            for (lev = 0; lev < LEVELS; lev++)
+            {
+                batt_icon_paint (&icon, w, h, st, lev);
+                cairo_surface_flush (icon.surface);
+
+                start = g_get_monotonic_time ();
+                ref = reference_icon (plug_pb, flash_pb, w, h, st, lev);
+                ref_total += g_get_monotonic_time () - start;
+                ref_frames++;
+
+                for (row = 0; row < h; row++)
+                {
+                    if (memcmp (cairo_image_surface_get_data (ref) + row * cairo_image_surface_get_stride (ref),
+                        cairo_image_surface_get_data (icon.surface) + row * stride, w * 4))
+                    {
+                        printf ("size %d (%dx%d) %s level %d differs at row %d\n", ic, w, h, names[st], lev, row);
+                        bad++;
+                        break;
+                    }
+                }
+                cairo_surface_destroy (ref);
+            }
+        }
+    }
+
+    printf ("%d frames, %.2f us per frame, %d allocations, %d differ from the cairo reference at %.2f us per frame\n",
+        frames, (double) total / frames, allocs, bad, (double) ref_total / ref_frames);
+
+    g_object_unref (plug_pb);
+    g_object_unref (flash_pb);
+    batt_icon_free (&icon);
+    return bad || allocs;
+}
+
+/* End of file */
+/*----------------------------------------------------------------------------*/
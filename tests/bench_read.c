@@ -0,0 +1,107 @@
+/*============================================================================
+Copyright (c) 2025 Raspberry Pi Holdings Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+============================================================================*/
+
+/* Time a sampling pass through batt_sys.c - the main battery's update and
+ * the refresh of the peripherals - against a power supply tree written to
+ * ACPI_PATH_SYS_POWER_SUPPLY, which the build points into the build
+ * directory. Built once reading with pread and once with io_uring, so the
+ * two can be compared. Regular files stand in for sysfs, so the times are
+ * of the system calls made, not of any driver. */
+
+#include <stdio.h>
+#include "batt_sys.h"
+#include "supply.h"
+
+/*----------------------------------------------------------------------------*/
+/* Typedefs and macros                                                        */
+/*----------------------------------------------------------------------------*/
+
+/* Peripheral batteries in the tree, and passes timed */
+#define DEVICES 4
+#define PASSES 20000
+
+#ifdef HAVE_IO_URING
+#define METHOD "io_uring"
+#else
+#define METHOD "pread"
+#endif
+
+/*----------------------------------------------------------------------------*/
+/* Benchmark                                                                  */
+/*----------------------------------------------------------------------------*/
+
+int main (void)
+{
+    char name[16];
+    battery *b;
+    GList self = { NULL, NULL, NULL }, *devices, *l;
+    gint64 start, update, refresh;
+    int i;
+
+    supply_gauge (ACPI_BATTERY_DEVICE_NAME "0", NULL);
+    for (i = 0; i < DEVICES; i++)
+    {
+        g_snprintf (name, sizeof (name), "hid-%d-battery", i);
+        supply_gauge (name, "Device\n");
+    }
+
+    b = battery_get (0);
+    devices = battery_get_devices ();
+    if (!b || g_list_length (devices) != DEVICES)
+    {
+        fprintf (stderr, "supply tree in %s not read\n", ACPI_PATH_SYS_POWER_SUPPLY);
+        return 1;
+    }
+
+    // the main battery, as each timer tick reads it
+    start = g_get_monotonic_time ();
+    for (i = 0; i < PASSES; i++) battery_update (b);
+    update = g_get_monotonic_time () - start;
+
+    // a tick with the peripherals due - all read in one pass, then parsed
+    self.data = b;
+    self.next = devices;
+    start = g_get_monotonic_time ();
+    for (i = 0; i < PASSES; i++)
+    {
+        battery_fetch (&self, FALSE);
+        battery_update (b);
+        for (l = devices; l; l = l->next) battery_update_uevent ((battery *) l->data);
+    }
+    refresh = g_get_monotonic_time () - start;
+
+    printf ("%s: %.2f us per battery update, %.2f us per update with %d peripherals\n",
+        METHOD, (double) update / PASSES, (double) refresh / PASSES, DEVICES);
+
+    g_list_free_full (devices, (GDestroyNotify) battery_free);
+    battery_free (b);
+    battery_fetch_close ();
+    return 0;
+}
+
+/* End of file */
+/*----------------------------------------------------------------------------*/
@@ -0,0 +1,72 @@
+/*============================================================================
+Copyright (c) 2025 Raspberry Pi Holdings Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+============================================================================*/
+
+#include <glib/gstdio.h>
+#include "batt_sys.h"
+#include "supply.h"
+
+/*----------------------------------------------------------------------------*/
+/* Function definitions                                                       */
+/*----------------------------------------------------------------------------*/
+
+/* Write one attribute of a supply, creating the supply if need be */
+
+void supply_attr (const char *supply, const char *attr, const char *val)
+{
+    gchar *file = g_build_filename (ACPI_PATH_SYS_POWER_SUPPLY, supply, attr, NULL);
+    gchar *dir = g_path_get_dirname (file);
+
+    g_mkdir_with_parents (dir, 0755);
+    g_file_set_contents (file, val, -1, NULL);
+    g_free (dir);
+    g_free (file);
+}
+
+/* Write a supply with the attributes a typical fuel gauge exports - scope is
+ * the scope attribute, or NULL for none, as for a system battery */
+
+void supply_gauge (const char *supply, const char *scope)
+{
+    supply_attr (supply, "type", "Battery\n");
+    supply_attr (supply, "status", "Discharging\n");
+    supply_attr (supply, "capacity", "57\n");
+    supply_attr (supply, "charge_now", "2850000\n");
+    supply_attr (supply, "charge_full", "5000000\n");
+    supply_attr (supply, "charge_full_design", "5200000\n");
+    supply_attr (supply, "current_now", "1250000\n");
+    supply_attr (supply, "voltage_now", "3812000\n");
+    supply_attr (supply, "model_name", "gauge\n");
+    supply_attr (supply, "serial_number", supply);
+    if (scope) supply_attr (supply, "scope", scope);
+    supply_attr (supply, "uevent",
+        "POWER_SUPPLY_NAME=gauge\nPOWER_SUPPLY_TYPE=Battery\nPOWER_SUPPLY_STATUS=Discharging\n"
+        "POWER_SUPPLY_CAPACITY=57\nPOWER_SUPPLY_CHARGE_NOW=2850000\nPOWER_SUPPLY_CHARGE_FULL=5000000\n"
+        "POWER_SUPPLY_CURRENT_NOW=1250000\nPOWER_SUPPLY_VOLTAGE_NOW=3812000\n");
+}
+
+/* End of file */
+/*----------------------------------------------------------------------------*/
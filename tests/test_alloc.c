@@ -0,0 +1,180 @@
+/*============================================================================
+Copyright (c) 2025 Raspberry Pi Holdings Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+============================================================================*/
+
+/* Check that the steady state makes no heap allocations: painting the icon,
+ * once the surface for a size exists, at every size, state and level, and
+ * sampling the batteries, once the first pass has made their read buffers.
+ * This only links the drawing and battery code, so runs without a display.
+ * The argument is the directory holding the symbols; the batteries are read
+ * from a power supply tree written to ACPI_PATH_SYS_POWER_SUPPLY. */
+
+#include <stdio.h>
+#include "batt_draw.h"
+#include "batt_sys.h"
+#include "alloc.h"
+#include "supply.h"
+
+/*----------------------------------------------------------------------------*/
+/* Typedefs and macros                                                        */
+/*----------------------------------------------------------------------------*/
+
+/* Panel icon sizes tried - from below the smallest icon, to exercise clipping */
+#define MIN_SIZE 1
+#define MAX_SIZE 128
+
+/* Peripheral batteries in the tree, and sampling passes counted */
+#define DEVICES 2
+#define PASSES 100
+
+/*----------------------------------------------------------------------------*/
+/* Prototypes                                                                 */
+/*----------------------------------------------------------------------------*/
+
+static int test_paint (const char *images);
+static int test_sampling (void);
+static void sample (battery *b, GList *devices);
+
+/*----------------------------------------------------------------------------*/
+/* Function definitions                                                       */
+/*----------------------------------------------------------------------------*/
+
+static int test_paint (const char *images)
+{
+    BattIcon icon;
+    gchar *plug, *flash;
+    int size, st, lev, w, h, failed = 0;
+
+    plug = g_build_filename (images, "plug.png", NULL);
+    flash = g_build_filename (images, "flash.png", NULL);
+    batt_icon_init (&icon, plug, flash);
+    g_free (plug);
+    g_free (flash);
+    if (!icon.plug || !icon.flash)
+    {
+        fprintf (stderr, "symbols not found in %s\n", images);
+        return 2;
+    }
+
+    for (size = MIN_SIZE; size <= MAX_SIZE; size++)
+    {
+        batt_icon_dims (size, &w, &h);
+
+        // the first paint at a size creates the surface
+        batt_icon_paint (&icon, w, h, STAT_DISCHARGING, 0);
+
+        alloc_count = 0;
+        alloc_counting = 1;
+        for (st = STAT_DISCHARGING; st <= STAT_ABSENT; st++)
+            for (lev = 0; lev <= 100; lev++) batt_icon_paint (&icon, w, h, st, lev);
+        alloc_counting = 0;
+
+        if (alloc_count)
+        {
+            printf ("size %d (%dx%d): %d allocations\n", size, w, h, alloc_count);
+            failed = 1;
+        }
+    }
+
+    batt_icon_free (&icon);
+    return failed;
+}
+
+/* One pass as a timer tick with the peripherals due makes it - all of them
+ * read together, then each parsed */
+
+static void sample (battery *b, GList *devices)
+{
+    GList self = { b, devices, NULL }, *l;
+
+    battery_fetch (&self, FALSE);
+    battery_update (b);
+    for (l = devices; l; l = l->next) battery_update_uevent ((battery *) l->data);
+}
+
+static int test_sampling (void)
+{
+    char name[16];
+    battery *b;
+    GList *devices;
+    int i, failed = 0;
+
+    supply_gauge (ACPI_BATTERY_DEVICE_NAME "0", NULL);
+    for (i = 0; i < DEVICES; i++)
+    {
+        g_snprintf (name, sizeof (name), "hid-%d-battery", i);
+        supply_gauge (name, "Device\n");
+    }
+
+    b = battery_get (0);
+    devices = battery_get_devices ();
+    if (!b || g_list_length (devices) != DEVICES)
+    {
+        fprintf (stderr, "supply tree in %s not read\n", ACPI_PATH_SYS_POWER_SUPPLY);
+        return 2;
+    }
+
+    // the first pass makes the read buffers, and sets io_uring up if used
+    sample (b, devices);
+
+    alloc_count = 0;
+    alloc_counting = 1;
+    for (i = 0; i < PASSES; i++) sample (b, devices);
+    alloc_counting = 0;
+
+    if (alloc_count)
+    {
+        printf ("sampling: %d allocations in %d passes\n", alloc_count, PASSES);
+        failed = 1;
+    }
+
+    g_list_free_full (devices, (GDestroyNotify) battery_free);
+    battery_free (b);
+    battery_fetch_close ();
+    return failed;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Test                                                                       */
+/*----------------------------------------------------------------------------*/
+
+int main (int argc, char *argv[])
+{
+    int paint, sampling;
+
+    if (argc < 2)
+    {
+        fprintf (stderr, "usage: %s <image directory>\n", argv[0]);
+        return 2;
+    }
+
+    paint = test_paint (argv[1]);
+    sampling = test_sampling ();
+    return MAX (paint, sampling);
+}
+
+/* End of file */
+/*----------------------------------------------------------------------------*/
@@ -0,0 +1,239 @@
+/*============================================================================
+Copyright (c) 2025 Raspberry Pi Holdings Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+============================================================================*/
+
+/* Check that readings at the extremes of what a driver can report - packs
+ * and rates past the old 32-bit milli-unit limits, values at and beyond
+ * the 64-bit limit, negative rates, and rates too small for the old units to
+ * show - give sensible levels and times, and that the statistics hold and
+ * persist them exactly. Readings come from a
+ * power supply tree written to ACPI_PATH_SYS_POWER_SUPPLY, which the build
+ * points into the build directory, as does XDG_DATA_HOME for the stored
+ * statistics. */
+
+#include <stdio.h>
+#include <glib/gstdio.h>
+#include "batt_sys.h"
+#include "batt_stats.h"
+#include "supply.h"
+
+/*----------------------------------------------------------------------------*/
+/* Typedefs and macros                                                        */
+/*----------------------------------------------------------------------------*/
+
+#define SUPPLY ACPI_BATTERY_DEVICE_NAME "0"
+#define DEVICE "hid-0-battery"
+#define STATS_ID "units-test"
+
+/* A reading, as the driver's attribute text, and what it should give */
+typedef struct
+{
+    const char *name;
+    const char *status;
+    const char *charge_now;
+    const char *charge_full;
+    const char *current_now;
+    int percentage;
+    int seconds;
+    gboolean charging;              /* Taken to be charging, as for no current */
+} UnitCase;
+
+/*----------------------------------------------------------------------------*/
+/* Global data                                                                */
+/*----------------------------------------------------------------------------*/
+
+static const UnitCase cases[] = {
+    { "small pack", "Discharging", "500000", "1000000", "250000", 50, 7200, FALSE },
+    { "past 32 bits", "Discharging", "3000000000", "6000000000", "1500000000", 50, 7200, FALSE },
+    { "charging past 32 bits", "Charging", "3000000000", "6000000000", "1500000000", 50, 7200, TRUE },
+    { "near the 64-bit limit", "Discharging", "4611686018427387904", "9223372036854775807", "1000", 50, G_MAXINT, FALSE },
+    { "beyond the 64-bit limit", "Discharging", "99999999999999999999", "1000000", "250000", 100, G_MAXINT, FALSE },
+    { "negative rate", "Discharging", "500000", "1000000", "-250000", 50, 7200, FALSE },
+    { "most negative rate", "Discharging", "500000", "1000000", "-9223372036854775808", 50, 0, FALSE },
+    { "rate unavailable", "Discharging", "500000", "1000000", "-1000", 50, -1, FALSE },
+    { "1 mA", "Discharging", "500000", "1000000", "1000", 50, 1800000, FALSE },
+    { "under 1 mA", "Discharging", "500000", "1000000", "999", 50, -1, TRUE },
+    { "idle pack", "Discharging", "500000", "1000000", "-300", 50, -1, TRUE },
+    { "no current", "Discharging", "500000", "1000000", "0", 50, -1, TRUE },
+    { "charging under 1 mA", "Charging", "500000", "1000000", "1", 50, -1, TRUE }
+};
+
+static int failed;
+
+/*----------------------------------------------------------------------------*/
+/* Prototypes                                                                 */
+/*----------------------------------------------------------------------------*/
+
+static void check (const char *name, const char *what, gint64 got, gint64 want);
+static void test_battery (const UnitCase *c);
+static void test_device (void);
+static void test_stats (void);
+
+/*----------------------------------------------------------------------------*/
+/* Function definitions                                                       */
+/*----------------------------------------------------------------------------*/
+
+static void check (const char *name, const char *what, gint64 got, gint64 want)
+{
+    if (got == want) return;
+    printf ("%s: %s is %" G_GINT64_FORMAT ", expected %" G_GINT64_FORMAT "\n", name, what, got, want);
+    failed = 1;
+}
+
+/* Read a battery through its attribute files, with no capacity file, so
+ * the level is worked out from the charge */
+
+static void test_battery (const UnitCase *c)
+{
+    battery *b;
+
+    supply_attr (SUPPLY, "type", "Battery\n");
+    supply_attr (SUPPLY, "status", c->status);
+    supply_attr (SUPPLY, "charge_now", c->charge_now);
+    supply_attr (SUPPLY, "charge_full", c->charge_full);
+    supply_attr (SUPPLY, "current_now", c->current_now);
+    supply_attr (SUPPLY, "voltage_now", "3800000");
+
+    b = battery_get (0);
+    if (!b)
+    {
+        printf ("%s: battery not read\n", c->name);
+        failed = 1;
+        return;
+    }
+    check (c->name, "percentage", b->percentage, c->percentage);
+    check (c->name, "seconds", b->seconds, c->seconds);
+    check (c->name, "charging", battery_is_charging (b), c->charging);
+    battery_free (b);
+}
+
+/* Read a peripheral through its uevent file */
+
+static void test_device (void)
+{
+    GList *devices;
+    battery *b;
+
+    supply_attr (DEVICE, "type", "Battery\n");
+    supply_attr (DEVICE, "scope", "Device\n");
+    supply_attr (DEVICE, "uevent", "POWER_SUPPLY_STATUS=Discharging\nPOWER_SUPPLY_CHARGE_NOW=3000000000\n"
+        "POWER_SUPPLY_CHARGE_FULL=6000000000\nPOWER_SUPPLY_CURRENT_NOW=-1500000000\n");
+
+    devices = battery_get_devices ();
+    if (g_list_length (devices) != 1)
+    {
+        printf ("uevent: device not read\n");
+        failed = 1;
+    }
+    else
+    {
+        b = (battery *) devices->data;
+        check ("uevent", "charge_full", b->charge_full, G_GINT64_CONSTANT (6000000000));
+        check ("uevent", "percentage", b->percentage, 50);
+        check ("uevent", "seconds", b->seconds, 7200);
+    }
+    g_list_free_full (devices, (GDestroyNotify) battery_free);
+}
+
+/* Fold readings past the old limits into the statistics, save and reload them */
+
+static void test_stats (void)
+{
+    BattStats s, t;
+    BattSnapshot snap = { STAT_DISCHARGING, 50, -1, 0, 3800000, 0, 0, G_USEC_PER_SEC };
+    gchar *file = g_build_filename (g_get_user_data_dir (), "batt", STATS_ID, NULL);
+
+    g_unlink (file);
+    g_free (file);
+    batt_stats_init (&s, STATS_ID);
+
+    // 2 kW for a second is 555.556 mWh
+    snap.power = G_GINT64_CONSTANT (2000000000);
+    snap.full = G_GINT64_CONSTANT (6000000000);
+    snap.design = G_GINT64_CONSTANT (6200000000);
+    batt_stats_update (&s, &snap);
+    snap.time += G_USEC_PER_SEC;
+    batt_stats_update (&s, &snap);
+    check ("stats", "total_drawn", s.total_drawn, 555556);
+    check ("stats", "wear", s.wear, 3);
+
+    // an impossible reading is not integrated, nor is the step after it
+    snap.power = G_MAXINT64;
+    snap.time += G_USEC_PER_SEC;
+    batt_stats_update (&s, &snap);
+    snap.power = G_GINT64_CONSTANT (2000000000);
+    snap.time += G_USEC_PER_SEC;
+    batt_stats_update (&s, &snap);
+    check ("stats", "total_drawn after a fault", s.total_drawn, 555556);
+    snap.time += G_USEC_PER_SEC;
+    batt_stats_update (&s, &snap);
+    check ("stats", "total_drawn", s.total_drawn, 1111112);
+
+    // capacities at the limit, with another second of drain
+    snap.full = G_MAXINT64;
+    snap.design = 1;
+    snap.time += G_USEC_PER_SEC;
+    batt_stats_update (&s, &snap);
+    check ("stats", "wear at the limit", s.wear, 0);
+
+    batt_stats_free (&s);
+    batt_stats_init (&s, STATS_ID);
+    check ("stats", "saved total_drawn", s.total_drawn, 1666668);
+    check ("stats", "saved full_min", s.full_min, G_GINT64_CONSTANT (6000000000));
+    check ("stats", "saved full_max", s.full_max, G_MAXINT64);
+
+    // a pack which runs flat never reaches batt_stats_free, so a long
+    // discharge is saved as it goes
+    snap.full = G_GINT64_CONSTANT (6000000000);
+    snap.design = G_GINT64_CONSTANT (6200000000);
+    snap.time += G_USEC_PER_SEC;
+    batt_stats_update (&s, &snap);
+    snap.time += G_USEC_PER_SEC;
+    batt_stats_update (&s, &snap);
+    snap.time += G_GINT64_CONSTANT (3600) * G_USEC_PER_SEC;
+    batt_stats_update (&s, &snap);
+    batt_stats_init (&t, STATS_ID);
+    check ("stats", "total_drawn saved while discharging", t.total_drawn, 2222224);
+    batt_stats_free (&t);
+    batt_stats_free (&s);
+}
+
+/*----------------------------------------------------------------------------*/
+/* Test                                                                       */
+/*----------------------------------------------------------------------------*/
+
+int main (void)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (cases); i++) test_battery (&cases[i]);
+    test_device ();
+    test_stats ();
+    return failed;
+}
+
+/* End of file */
+/*----------------------------------------------------------------------------*/